@@ -8,13 +8,14 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define USERTOP  0xA0000 // end of user address space
-#define PHYSTOP  0x1000000 // use phys mem up to here as free pool
+#define KMAXORDER    10  // largest kalloc_order(): 2^10 pages (4MB)
+#define PHYSMAX  0xE0000000 // never use phys mem above here (PCI hole)
 #define MAXARG       32  // max exec arguments
+#ifndef HZ
+#define HZ          100  // clock ticks per second (make HZ=...)
+#endif
 
 #endif // _PARAM_H_
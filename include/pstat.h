@@ -9,9 +9,20 @@ struct pstat {
     int priority[NPROC];  // current priority level of each process (0-3)
     enum procstate state[NPROC];  // current state (e.g., SLEEPING or RUNNABLE) of each process
     int ticks[NPROC][4];  // number of ticks each process has accumulated at each of 4 priorities
-    int wait_ticks[NPROC][4]; // number of ticks each process has waited before being scheduled
+    int wait_ticks[NPROC][4]; // clock ticks each process has spent queued at each priority since it last ran
+};
+
+// Per-CPU idle time, in TSC cycles, and page allocator counters.
+struct cpustat {
+    int ncpu;                // number of CPUs in use
+    uint64 idle[NCPU];       // cycles each CPU has spent halted with nothing to run
+    uint64 elapsed[NCPU];    // cycles since each CPU entered its scheduler
+    uint kallochits[NCPU];   // kalloc()s served from each CPU's page cache
+    uint kallocmisses[NCPU]; // kalloc()s that had to go to the global free list
+    uint freeblocks[KMAXORDER+1]; // free blocks of 2^i pages in the buddy allocator
 };
 
 int getpinfo(struct pstat*);
+int getcpustat(struct cpustat*);
 
 #endif //_PSTAT_H_
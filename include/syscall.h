@@ -24,4 +24,8 @@
 #define SYS_sleep  20
 #define SYS_uptime 21
 #define SYS_getpinfo 22
+#define SYS_getcpustat 23
+#define SYS_nanouptime 24
+#define SYS_sync 25
+#define SYS_fsync 26
 #endif // _SYSCALL_H_
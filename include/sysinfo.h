@@ -0,0 +1,39 @@
+#ifndef _SYSINFO_H_
+#define _SYSINFO_H_
+
+#include "param.h"
+
+// Two read-only pages that the kernel maps into every process just
+// above its memory, so that user code can read the clock, its pid
+// and its CPU without a system call (see ulib.c).
+#define SYSINFO   USERTOP             // struct sysinfo, shared by all
+#define PROCINFO  (USERTOP + 0x1000)  // struct procinfo, per process
+
+#ifndef __ASSEMBLER__
+struct sysinfo {
+  uint sysenter;              // use sysenter; must be first for usys.S
+  volatile uint ticks;        // clock ticks since boot
+  uint hz;                    // clock ticks per second
+  uint64 tscmult;             // nanoseconds per TSC cycle, << 32
+  uint64 tscboot;             // TSC at boot
+};
+
+struct procinfo {
+  int pid;                    // process ID
+  volatile int cpu;           // CPU the process is running on
+};
+
+// Nanoseconds in cycles TSC cycles.  cycles * tscmult needs more
+// than 64 bits, so the product is done in 32-bit pieces.
+static inline uint64
+tscns(uint64 cycles, uint64 tscmult)
+{
+  uint64 mi, mf;
+
+  mi = tscmult >> 32;
+  mf = tscmult & 0xffffffff;
+  return cycles*mi + (cycles >> 32)*mf + (((cycles & 0xffffffff) * mf) >> 32);
+}
+#endif
+
+#endif // _SYSINFO_H_
@@ -11,6 +11,15 @@ inb(ushort port)
   return data;
 }
 
+static inline uint
+inl(ushort port)
+{
+  uint data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
 static inline void
 insl(int port, void *addr, int cnt)
 {
@@ -32,6 +41,12 @@ outw(ushort port, ushort data)
   asm volatile("out %0,%1" : : "a" (data), "d" (port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+  asm volatile("out %0,%1" : : "a" (data), "d" (port));
+}
+
 static inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -114,6 +129,15 @@ resp(void)
   return val;
 }
 
+// Index of the most significant set bit of v; v must be non-zero.
+static inline uint
+bsr(uint v)
+{
+  uint r;
+  asm volatile("bsrl %1,%0" : "=r" (r) : "rm" (v) : "cc");
+  return r;
+}
+
 static inline void
 cli(void)
 {
@@ -126,6 +150,54 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until one arrives.  sti takes effect
+// only after the next instruction, so no interrupt can be taken
+// between the two and missed by the hlt.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
+static inline void
+cpuid(uint op, uint *eaxp, uint *ebxp, uint *ecxp, uint *edxp)
+{
+  uint eax, ebx, ecx, edx;
+
+  asm volatile("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                       : "a" (op), "c" (0));
+  if(eaxp)
+    *eaxp = eax;
+  if(ebxp)
+    *ebxp = ebx;
+  if(ecxp)
+    *ecxp = ecx;
+  if(edxp)
+    *edxp = edx;
+}
+
+static inline void
+wrmsr(uint msr, uint64 val)
+{
+  asm volatile("wrmsr" : : "c" (msr), "A" (val));
+}
+
+static inline uint64
+rdtsc(void)
+{
+  uint64 val;
+  asm volatile("rdtsc" : "=A" (val));
+  return val;
+}
+
+// Atomically add v to *addr; return the old value of *addr.
+static inline int
+xadd(volatile int *addr, int v)
+{
+  asm volatile("lock; xaddl %0, %1" : "+r" (v), "+m" (*addr) : : "memory");
+  return v;
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -175,6 +247,27 @@ rcr3(void)
   return val;
 }
 
+static inline void
+lcr4(uint val)
+{
+  asm volatile("movl %0,%%cr4" : : "r" (val));
+}
+
+static inline uint
+rcr4(void)
+{
+  uint val;
+  asm volatile("movl %%cr4,%0" : "=r" (val));
+  return val;
+}
+
+// Drop the TLB entry for the page holding virtual address va.
+static inline void
+invlpg(void *va)
+{
+  asm volatile("invlpg (%0)" : : "r" (va) : "memory");
+}
+
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().
 struct trapframe {
@@ -1,13 +1,13 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 // 
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to flush it to disk.
+// * After changing buffer data, call bwrite to mark it for writing.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -20,39 +20,160 @@
 //     with the associated disk block contents.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Writes are delayed: a dirty buffer stays in the cache until the
+// flusher process finds it has been dirty for FLUSHAGE ticks, until
+// sync or fsync, or until bget() recycles it.  The flusher and sync
+// write buffers back in sector order.
+//
+// binit() gives the cache 1/BUFFRAC of physical memory.  Buffers are
+// hashed by (dev, sector) into buckets, each with its own lock, which
+// protects the chain and the flags of the buffers on it; a lookup
+// that hits takes only that lock.  A miss recycles a buffer chosen by
+// the clock algorithm: all buffers are on a circular list through
+// b->next, bget() sets b->used on every use, and the clock hand
+// passes over (and clears) used buffers.  bcache.lock serializes
+// recycling.  Lock order is bcache.lock, then the bucket of the
+// block being looked up, then the bucket of the buffer recycled.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "buf.h"
 
-struct {
+#define BUFFRAC  32     // 1/BUFFRAC of memory goes to buffers
+#define MAXBUF   32768  // 16MB of data
+#define FLUSHAGE (5*HZ) // write back buffers dirty this long
+#define NFLUSH   64     // buffers sorted per batch by bflush
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;  // chains through buf->hnext
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;     // held while recycling a buffer
+  struct buf *hand;         // clock hand
+  int nbuf;
+  uint nbucket;             // a power of two
+  struct bucket *bucket;
 } bcache;
 
+#define BHASH(dev, sector) (&bcache.bucket[((dev) * 31 + (sector)) & (bcache.nbucket - 1)])
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct buf *b, *last;
+  struct bucket *h;
+  int i, n, order;
+  char *p;
 
   initlock(&bcache.lock, "bcache");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Allocate buffers, PGSIZE/sizeof(*b) to a page, and link
+  // them on the clock's circular list.
+  last = 0;
+  n = PGSIZE / sizeof(*b);
+  for(i = 0; i < phystop/BUFFRAC/PGSIZE && bcache.nbuf + n <= MAXBUF; i++){
+    if((p = kalloc()) == 0)
+      break;
+    for(b = (struct buf*)p; b < (struct buf*)p + n; b++){
+      memset(b, 0, sizeof(*b));
+      if(last)
+        last->next = b;
+      else
+        bcache.hand = b;
+      last = b;
+      bcache.nbuf++;
+    }
+  }
+  if(bcache.nbuf == 0)
+    panic("binit");
+  last->next = bcache.hand;
+
+  // About two buffers per bucket.
+  for(bcache.nbucket = 1; bcache.nbucket*2 < bcache.nbuf; bcache.nbucket *= 2)
+    ;
+  for(order = 0; (PGSIZE << order) < bcache.nbucket*sizeof(*h); order++)
+    ;
+  if((bcache.bucket = (struct bucket*)kalloc_order(order)) == 0)
+    panic("binit: buckets");
+  for(h = bcache.bucket; h < bcache.bucket + bcache.nbucket; h++){
+    initlock(&h->lock, "bucket");
+    h->head = 0;
+  }
+
+  // Hash the free buffers as blocks of a device that does not exist.
+  b = bcache.hand;
+  for(i = 0; i < bcache.nbuf; i++, b = b->next){
     b->dev = -1;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->sector = i;
+    h = BHASH(b->dev, b->sector);
+    b->hnext = h->head;
+    h->head = b;
   }
+  cprintf("bcache: %d buffers\n", bcache.nbuf);
+}
+
+// Look for sector on device dev in bucket h, which must be locked.
+static struct buf*
+lookup(struct bucket *h, uint dev, uint sector)
+{
+  struct buf *b;
+
+  for(b = h->head; b; b = b->hnext)
+    if(b->dev == dev && b->sector == sector)
+      return b;
+  return 0;
+}
+
+// Choose a buffer to recycle by the clock algorithm and take it
+// out of its bucket.  If it is dirty, it is marked B_BUSY and
+// left in its bucket instead, for the caller to write it back.
+// Caller must hold bcache.lock and h->lock.
+static struct buf*
+recycle(struct bucket *h)
+{
+  struct buf *b, **pp;
+  struct bucket *bh;
+  int i;
+
+  // Two trips round the clock: the first may only clear used bits.
+  for(i = 0; i < 2*bcache.nbuf; i++){
+    b = bcache.hand;
+    bcache.hand = b->next;
+    if(b->flags & B_BUSY)  // unlocked peek; checked again below
+      continue;
+    if(b->used){
+      b->used = 0;
+      continue;
+    }
+    bh = BHASH(b->dev, b->sector);
+    if(bh != h)
+      acquire(&bh->lock);
+    if(b->flags & B_BUSY){
+      if(bh != h)
+        release(&bh->lock);
+      continue;
+    }
+    if(b->flags & B_DIRTY){
+      b->flags |= B_BUSY;
+      if(bh != h)
+        release(&bh->lock);
+      return b;
+    }
+    for(pp = &bh->head; *pp != b; pp = &(*pp)->hnext)
+      ;
+    *pp = b->hnext;
+    if(bh != h)
+      release(&bh->lock);
+    return b;
+  }
+  panic("bget: no buffers");
 }
 
 // Look through buffer cache for sector on device dev.
@@ -61,35 +182,52 @@ binit(void)
 static struct buf*
 bget(uint dev, uint sector)
 {
+  struct bucket *h;
   struct buf *b;
 
-  acquire(&bcache.lock);
+  h = BHASH(dev, sector);
+  acquire(&h->lock);
 
  loop:
   // Try for cached block.
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->sector == sector){
-      if(!(b->flags & B_BUSY)){
-        b->flags |= B_BUSY;
-        release(&bcache.lock);
-        return b;
-      }
-      sleep(b, &bcache.lock);
-      goto loop;
+  if((b = lookup(h, dev, sector)) != 0){
+    if(!(b->flags & B_BUSY)){
+      b->flags |= B_BUSY;
+      b->used = 1;
+      release(&h->lock);
+      return b;
     }
+    sleep(b, &h->lock);
+    goto loop;
   }
+  release(&h->lock);
 
-  // Allocate fresh block.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0){
-      b->dev = dev;
-      b->sector = sector;
-      b->flags = B_BUSY;
-      release(&bcache.lock);
-      return b;
-    }
+  // Recycle a buffer for it, unless someone else
+  // got in first while h was unlocked.
+  acquire(&bcache.lock);
+  acquire(&h->lock);
+  if(lookup(h, dev, sector) != 0){
+    release(&bcache.lock);
+    goto loop;
   }
-  panic("bget: no buffers");
+  b = recycle(h);
+  if(b->flags & B_DIRTY){
+    release(&h->lock);
+    release(&bcache.lock);
+    iderw(b);
+    brelse(b);
+    acquire(&h->lock);
+    goto loop;
+  }
+  b->dev = dev;
+  b->sector = sector;
+  b->flags = B_BUSY;
+  b->used = 1;
+  b->hnext = h->head;
+  h->head = b;
+  release(&h->lock);
+  release(&bcache.lock);
+  return b;
 }
 
 // Return a B_BUSY buf with the contents of the indicated disk sector.
@@ -104,35 +242,154 @@ bread(uint dev, uint sector)
   return b;
 }
 
-// Write b's contents to disk.  Must be locked.
+// Start reading the indicated disk sector into the cache,
+// unless it is there already, without waiting for it.
+void
+bprefetch(uint dev, uint sector)
+{
+  struct bucket *h;
+  struct buf *b;
+
+  h = BHASH(dev, sector);
+  acquire(&h->lock);
+  b = lookup(h, dev, sector);
+  release(&h->lock);
+  if(b)
+    return;
+  b = bget(dev, sector);
+  if(b->flags & B_VALID)
+    brelse(b);
+  else
+    iderwasync(b);
+}
+
+// Mark b's contents to be written to disk later.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if((b->flags & B_BUSY) == 0)
     panic("bwrite");
-  b->flags |= B_DIRTY;
-  iderw(b);
+  if(!(b->flags & B_DIRTY))
+    b->dirtied = ticks;
+  b->flags |= B_DIRTY | B_VALID;
+}
+
+// If the indicated disk sector is cached and dirty, write it
+// to disk: now, or if async, start the write and return.
+static void
+bwriteback1(uint dev, uint sector, int async)
+{
+  struct bucket *h;
+  struct buf *b;
+
+  h = BHASH(dev, sector);
+  acquire(&h->lock);
+  for(;;){
+    b = lookup(h, dev, sector);
+    if(b == 0 || !(b->flags & B_DIRTY)){
+      release(&h->lock);
+      return;
+    }
+    if(!(b->flags & B_BUSY))
+      break;
+    sleep(b, &h->lock);
+  }
+  b->flags |= B_BUSY;
+  release(&h->lock);
+  if(async)
+    iderwasync(b);
+  else {
+    iderw(b);
+    brelse(b);
+  }
+}
+
+// If the indicated disk sector is cached and dirty,
+// write it to disk now.
+void
+bwriteback(uint dev, uint sector)
+{
+  bwriteback1(dev, sector, 0);
+}
+
+struct bsector {
+  uint dev;
+  uint sector;
+};
+
+// Write back the n buffers in v, in sector order.  The writes
+// are all queued before waiting for any, so that the disk driver
+// can merge those of consecutive sectors.
+static void
+bwritebatch(struct bsector *v, int n)
+{
+  struct bsector t;
+  int i, j;
+
+  for(i = 1; i < n; i++){
+    t = v[i];
+    for(j = i; j > 0 && (v[j-1].dev > t.dev ||
+        (v[j-1].dev == t.dev && v[j-1].sector > t.sector)); j--)
+      v[j] = v[j-1];
+    v[j] = t;
+  }
+  for(i = 0; i < n; i++)
+    bwriteback1(v[i].dev, v[i].sector, 1);
+  for(i = 0; i < n; i++)
+    bwriteback1(v[i].dev, v[i].sector, 0);  // waits for the write
+}
+
+// Write back every buffer that has been dirty for at least
+// age ticks.  The scan of the buffers is unlocked, so a buffer
+// dirtied during it may be missed; bwriteback rechecks each one.
+void
+bflush(uint age)
+{
+  struct bsector v[NFLUSH];
+  struct buf *b;
+  int i, n;
+
+  n = 0;
+  b = bcache.hand;
+  for(i = 0; i < bcache.nbuf; i++, b = b->next){
+    if(!(b->flags & B_DIRTY) || ticks - b->dirtied < age)
+      continue;
+    v[n].dev = b->dev;
+    v[n].sector = b->sector;
+    if(++n == NFLUSH){
+      bwritebatch(v, n);
+      n = 0;
+    }
+  }
+  bwritebatch(v, n);
+}
+
+// The flusher kernel process: once a second, write back the
+// buffers that have been dirty for FLUSHAGE ticks.
+void
+flusher(void)
+{
+  for(;;){
+    acquire(&tickslock);
+    proc->killed = 0;  // not killable: it never returns to user space
+    timersleep(ticks + HZ);
+    release(&tickslock);
+    bflush(FLUSHAGE);
+  }
 }
 
 // Release the buffer b.
 void
 brelse(struct buf *b)
 {
+  struct bucket *h;
+
   if((b->flags & B_BUSY) == 0)
     panic("brelse");
 
-  acquire(&bcache.lock);
-
-  b->next->prev = b->prev;
-  b->prev->next = b->next;
-  b->next = bcache.head.next;
-  b->prev = &bcache.head;
-  bcache.head.next->prev = b;
-  bcache.head.next = b;
-
+  h = BHASH(b->dev, b->sector);
+  acquire(&h->lock);
   b->flags &= ~B_BUSY;
   wakeup(b);
-
-  release(&bcache.lock);
+  release(&h->lock);
 }
-
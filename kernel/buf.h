@@ -5,13 +5,16 @@ struct buf {
   int flags;
   uint dev;
   uint sector;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  int used;         // used since the clock hand last passed
+  uint dirtied;     // ticks when B_DIRTY was last set
+  struct buf *next; // clock list
+  struct buf *hnext; // hash chain
   struct buf *qnext; // disk queue
   uchar data[512];
 };
 #define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // nobody waits: ideintr releases the buffer
 
 #endif // _BUF_H_
@@ -5,17 +5,25 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kcache;
 struct pipe;
 struct proc;
 struct spinlock;
 struct stat;
 struct pstat;
+struct cpustat;
+struct sysinfo;
+struct procinfo;
 
 // bio.c
 void            binit(void);
+void            bflush(uint);
+void            bprefetch(uint, uint);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwriteback(uint, uint);
+void            flusher(void) __attribute__((noreturn));
 
 // console.c
 void            consoleinit(void);
@@ -33,6 +41,7 @@ struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
+int             filesync(struct file*);
 int             filewrite(struct file*, char*, int n);
 
 // fs.c
@@ -43,6 +52,7 @@ struct inode*   idup(struct inode*);
 void            iinit(void);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            isync(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -57,6 +67,7 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderwasync(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -65,8 +76,16 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kalloc_order(int);
+char*           kalloc_zeroed(void);
+void            kallocstat(struct cpustat*);
 void            kfree(char*);
+void            kfree_order(char*, int);
 void            kinit(void);
+void            kref(char*);
+int             krefs(char*);
+int             kzerofill(void);
+extern uint     phystop;
 
 // kbd.c
 void            kbdintr(void);
@@ -74,8 +93,14 @@ void            kbdintr(void);
 // lapic.c
 int             cpunum(void);
 extern volatile uint*    lapic;
+extern uint     lapicticr;
+uint            lapiccount(void);
 void            lapiceoi(void);
 void            lapicinit(int);
+void            lapicipi(int, int);
+void            lapiconeshot(uint);
+int             lapicpending(int);
+void            lapicperiodic(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -85,6 +110,11 @@ int             mpbcpu(void);
 void            mpinit(void);
 void            mpstartthem(void);
 
+// pci.c
+int             pcifind(int, int);
+uint            pciread(int, int);
+void            pciwrite(int, int, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -92,6 +122,7 @@ void            picinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+void            pipeinit(void);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
@@ -101,6 +132,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kproc(char*, void (*)(void));
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
@@ -111,6 +143,12 @@ int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 int             getpinfo(struct pstat*);
+int             getcpustat(struct cpustat*);
+
+// slab.c
+void*           kcache_alloc(struct kcache*);
+void            kcache_free(struct kcache*, void*);
+void            kcacheinit(struct kcache*, char*, uint);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -142,10 +180,18 @@ int             fetchstr(struct proc*, uint, char**);
 void            syscall(void);
 
 // timer.c
+extern struct sysinfo *sysinfo;
+void            clockinit(void);
+uint64          nanouptime(void);
+void            timerbusy(void);
+void            timeridle(void);
 void            timerinit(void);
+void            timerintr(void);
+void            timersleep(uint);
 
 // trap.c
 void            idtinit(void);
+void            sysenterinit(void);
 extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
@@ -160,6 +206,7 @@ void            seginit(void);
 void            kvmalloc(void);
 void            vmenable(void);
 pde_t*          setupkvm(void);
+int             mapprocinfo(pde_t*, struct procinfo*);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
@@ -167,6 +214,8 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             pagefault(pde_t*, uint, uint);
+int             populateuvm(pde_t*, uint, uint, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
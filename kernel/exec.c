@@ -30,6 +30,8 @@ exec(char *path, char **argv)
 
   if((pgdir = setupkvm()) == 0)
     goto bad;
+  if(mapprocinfo(pgdir, proc->info) < 0)
+    goto bad;
 
   // Load program into memory.
   sz = 0;
@@ -18,6 +18,10 @@ struct inode {
   uint inum;          // Inode number
   int ref;            // Reference count
   int flags;          // I_BUSY, I_VALID
+  struct inode *hnext; // Next in icache hash chain
+  uint raoff;         // Where the last read ended
+  uint raend;         // First block not yet read ahead
+  uint rawin;         // Read-ahead window, in blocks; 0 if not sequential
 
   short type;         // copy of disk inode
   short major;
@@ -17,6 +17,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "slab.h"
 #include "buf.h"
 #include "fs.h"
 #include "file.h"
@@ -119,7 +120,9 @@ bfree(int dev, uint b)
 // 
 // ip->ref counts the number of pointer references to this cached
 // inode; references are typically kept in struct file and in proc->cwd.
-// When ip->ref falls to zero, the inode is no longer cached.
+// When ip->ref falls to zero, the inode is no longer cached, and
+// its memory goes back to the slab allocator.  Cached inodes are
+// found by hashing their device and inode numbers.
 // It is an error to use an inode without holding a reference to it.
 //
 // Processes are only allowed to read and write inode
@@ -138,15 +141,20 @@ bfree(int dev, uint b)
 // responsibility to lock them before using them.  A non-zero
 // ip->ref keeps these unlocked inodes in the cache.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];  // chains through ip->hnext
+  struct kcache cache;
 } icache;
 
 void
 iinit(void)
 {
   initlock(&icache.lock, "icache");
+  kcacheinit(&icache.cache, "inode", sizeof(struct inode));
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -200,31 +208,30 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **bucket;
 
   acquire(&icache.lock);
 
   // Try for cached inode.
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  bucket = &icache.hash[IHASH(dev, inum)];
+  for(ip = *bucket; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
   // Allocate fresh inode.
-  if(empty == 0)
+  if((ip = kcache_alloc(&icache.cache)) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  ip->hnext = *bucket;
+  *bucket = ip;
   release(&icache.lock);
 
   return ip;
@@ -290,6 +297,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp;
+
   acquire(&icache.lock);
   if(ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0){
     // inode is no longer used: truncate and free inode.
@@ -304,7 +313,12 @@ iput(struct inode *ip)
     ip->flags = 0;
     wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref == 0){
+    for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+    kcache_free(&icache.cache, ip);
+  }
   release(&icache.lock);
 }
 
@@ -316,6 +330,37 @@ iunlockput(struct inode *ip)
   iput(ip);
 }
 
+// Write ip's inode, its data and indirect blocks, and the
+// free-block bitmap to disk, if they are dirty in the buffer cache.
+void
+isync(struct inode *ip)
+{
+  struct buf *bp;
+  struct superblock sb;
+  uint a[NINDIRECT];
+  uint b;
+  int i;
+
+  ilock(ip);
+  for(i = 0; i < NDIRECT; i++)
+    if(ip->addrs[i])
+      bwriteback(ip->dev, ip->addrs[i]);
+  if(ip->addrs[NDIRECT]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    memmove(a, bp->data, sizeof(a));
+    brelse(bp);
+    for(i = 0; i < NINDIRECT; i++)
+      if(a[i])
+        bwriteback(ip->dev, a[i]);
+    bwriteback(ip->dev, ip->addrs[NDIRECT]);
+  }
+  bwriteback(ip->dev, IBLOCK(ip->inum));
+  readsb(ip->dev, &sb);
+  for(b = BBLOCK(0, sb.ninodes); b <= BBLOCK(sb.size-1, sb.ninodes); b++)
+    bwriteback(ip->dev, b);
+  iunlock(ip);
+}
+
 // Inode contents
 //
 // The contents (data) associated with each inode is stored
@@ -399,6 +444,37 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Sequential read-ahead.  A read that starts where the last read
+// of ip ended keeps a window of the blocks after it on their way
+// into the buffer cache.  The window starts at RAMIN blocks and
+// doubles, up to RAMAX, each time it is topped up; any other read
+// closes it.  Caller must hold ip's lock.
+#define RAMIN  4
+#define RAMAX 32
+
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, last;
+
+  if(off != ip->raoff){
+    ip->raoff = off + n;
+    ip->raend = 0;
+    ip->rawin = 0;
+    return;
+  }
+  ip->raoff = off + n;
+  bn = (off + n + BSIZE - 1) / BSIZE;  // first block after this read
+  if(ip->raend < bn)
+    ip->raend = bn;
+  if(ip->rawin && ip->raend - bn >= ip->rawin/2)
+    return;  // enough still ahead of the reader
+  ip->rawin = ip->rawin ? min(2*ip->rawin, RAMAX) : RAMIN;
+  last = min(bn + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  for(; ip->raend < last; ip->raend++)
+    bprefetch(ip->dev, bmap(ip, ip->raend));
+}
+
 // Read data from inode.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
@@ -416,6 +492,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint sector_number = bmap(ip, off/BSIZE);
@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.  Uses bus-master DMA through a PIIX
+// style PCI IDE controller if there is one, PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -17,17 +18,68 @@
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+#define IDE_MAXSECT   128  // sectors per command
+#define IDE_MULT      16   // sectors per interrupt, if the disk agrees
+
+// Bus master IDE registers, at idebm for the primary channel.
+#define BM_CMD        0     // Command: BM_START, BM_READ
+#define BM_STATUS     2     // Status: BM_ERR, BM_INTR (write 1 to clear)
+#define BM_PRDT       4     // Physical address of the PRD table
+#define BM_START      0x01
+#define BM_READ       0x08  // transfer from disk to memory
+#define BM_ERR        0x02
+#define BM_INTR       0x04
+
+// Physical region descriptor: one piece of memory in a DMA
+// transfer.  The controller reads the table until PRD_EOT.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT       0x8000
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
 // You must hold idelock while manipulating queue.
+//
+// The queue is kept in one-way elevator order: by sector, counting
+// up (and around) from the sector of idequeue, so that the disk
+// head sweeps across the disk.  Sequential I/O arrives in that order
+// already and is appended in O(1) at idetail; anything else is
+// inserted by walking the queue.  Since the order is counted from
+// the moving head, a steady ascending stream can keep a request
+// that lands just behind the head waiting until the stream ends.
+//
+// idestart() issues one command for the run of queued bufs with
+// consecutive sectors at the head of the queue, up to IDE_MAXSECT
+// of them, and the disk interrupts once every idemult sectors of it.
+// With DMA the controller moves the data of the whole command
+// straight to or from the bufs, and the disk interrupts once, at
+// the end.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *idetail;
+static int idecount;  // bufs in the command now running, not yet done
+static int ideblock;  // of which the disk has the data (write) or
+                      // we are waiting for it (read)
+static int idemult = 1;
+static int idebm;     // bus master I/O base; 0 if no DMA
+// One entry per buf of a command.  Must not cross a 64KB boundary.
+static volatile struct prd prdt[IDE_MAXSECT] __attribute__((aligned(1024)));
 
 static int havedisk1;
 static void idestart(struct buf*);
 
+#define QKEY(b) ((b)->sector - idequeue->sector)
+
 // Wait for IDE disk to become ready.
 static int
 idewait(int checkerr)
@@ -41,6 +93,39 @@ idewait(int checkerr)
   return 0;
 }
 
+// Ask disk d to interrupt only once every IDE_MULT sectors of
+// a READ or WRITE MULTIPLE.  Returns 0 if it will.
+static int
+idesetmult(int d)
+{
+  outb(0x1f6, 0xe0 | (d<<4));
+  outb(0x1f2, IDE_MULT);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  return idewait(1);
+}
+
+// Look for a PCI IDE controller that can do bus-master DMA
+// on the legacy primary channel, and turn DMA on if found.
+static void
+idedmainit(void)
+{
+  int pf;
+  uint c, bar;
+
+  if((pf = pcifind(0x01, 0x01)) < 0)  // mass storage, IDE
+    return;
+  c = pciread(pf, 0x08);
+  if(!(c & (0x80<<8)) || (c & (0x01<<8)))  // no bus master, or not at 0x1f0
+    return;
+  bar = pciread(pf, 0x20);  // BAR4: bus master registers
+  if(!(bar & 1))
+    return;
+  pciwrite(pf, 0x04, pciread(pf, 0x04) | 0x05);  // enable I/O and bus master
+  idebm = bar & 0xfffc;
+  outb(idebm+BM_CMD, 0);
+  outb(idebm+BM_STATUS, BM_ERR|BM_INTR);
+}
+
 void
 ideinit(void)
 {
@@ -60,29 +145,79 @@ ideinit(void)
     }
   }
   
+  // Use multiple mode if every disk takes it.  The interrupts
+  // these commands raise find idequeue empty and are ignored.
+  if(idesetmult(0) == 0 && (!havedisk1 || idesetmult(1) == 0))
+    idemult = IDE_MULT;
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  idedmainit();
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Send the data of the next block of writes to the disk.
+// Caller must hold idelock.
+static void
+idesend(void)
+{
+  struct buf *b;
+  int i;
+
+  ideblock = idecount < idemult ? idecount : idemult;
+  for(i = 0, b = idequeue; i < ideblock; i++, b = b->qnext)
+    outsl(0x1f0, b->data, 512/4);
+}
+
+// Start the request for b, and for the bufs after it on the
+// queue that continue it.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *e;
+  int i, n, write;
+
   if(b == 0)
     panic("idestart");
 
+  write = (b->flags & B_DIRTY) != 0;
+  n = 1;
+  for(e = b; n < IDE_MAXSECT && e->qnext; e = e->qnext, n++){
+    if(e->qnext->dev != b->dev || e->qnext->sector != e->sector + 1 ||
+       ((e->qnext->flags & B_DIRTY) != 0) != write)
+      break;
+  }
+  idecount = n;
+
+  if(idebm){
+    for(i = 0, e = b; i < n; i++, e = e->qnext){
+      prdt[i].addr = (uint)e->data;
+      prdt[i].len = 512;
+      prdt[i].flags = 0;
+    }
+    prdt[n-1].flags = PRD_EOT;
+    outl(idebm+BM_PRDT, (uint)prdt);
+    outb(idebm+BM_CMD, write ? 0 : BM_READ);
+    outb(idebm+BM_STATUS, BM_ERR|BM_INTR);
+  }
+
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
+  outb(0x1f2, n);  // number of sectors
   outb(0x1f3, b->sector & 0xff);
   outb(0x1f4, (b->sector >> 8) & 0xff);
   outb(0x1f5, (b->sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+  if(idebm){
+    outb(0x1f7, write ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm+BM_CMD, BM_START | (write ? 0 : BM_READ));
+    ideblock = idecount;
+  } else if(write){
+    outb(0x1f7, idemult > 1 ? IDE_CMD_WRMUL : IDE_CMD_WRITE);
+    idesend();
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    outb(0x1f7, idemult > 1 ? IDE_CMD_RDMUL : IDE_CMD_READ);
+    ideblock = idecount < idemult ? idecount : idemult;
   }
 }
 
@@ -91,39 +226,67 @@ void
 ideintr(void)
 {
   struct buf *b;
+  int i, ok, s;
 
-  // Take first buffer off queue.
   acquire(&idelock);
-  if((b = idequeue) == 0){
+  if(idequeue == 0){
     release(&idelock);
     // cprintf("spurious IDE interrupt\n");
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
-  
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
-  
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  // The disk is done with a block: read its data if needed,
+  // then take its bufs off the queue.
+  if(idebm){
+    s = inb(idebm+BM_STATUS);
+    outb(idebm+BM_CMD, 0);  // stop the transfer
+    outb(idebm+BM_STATUS, s);
+    ok = !(s & BM_ERR) && idewait(1) >= 0;
+  } else
+    ok = idewait(1) >= 0;
+  // On an error the disk aborts the rest of the command and
+  // will not interrupt again: retire all of it now.
+  if(!ok)
+    ideblock = idecount;
+  for(i = 0; i < ideblock; i++){
+    b = idequeue;
+    idequeue = b->qnext;
+    if(idequeue == 0)
+      idetail = 0;
+    if(!(b->flags & B_DIRTY) && ok && !idebm)
+      insl(0x1f0, b->data, 512/4);
+
+    // Wake process waiting for this buf, or release it
+    // if nobody is waiting.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      brelse(b);
+    } else
+      wakeup(b);
+  }
+  idecount -= ideblock;
+
+  if(idecount > 0){
+    // More of this command to come.
+    if(idequeue->flags & B_DIRTY)
+      idesend();
+    else
+      ideblock = idecount < idemult ? idecount : idemult;
+  } else if(idequeue != 0)
+    idestart(idequeue);  // Start disk on next buf in queue.
 
   release(&idelock);
 }
 
-// Sync buf with disk. 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Insert b into idequeue and start the disk if it is idle.
+// Caller must hold idelock.
+static void
+ideappend(struct buf *b)
 {
   struct buf **pp;
+  int i;
 
   if(!(b->flags & B_BUSY))
     panic("iderw: buf not busy");
@@ -132,17 +295,48 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);
-
-  // Append b to idequeue.
   b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)
+  if(idequeue == 0){
+    idequeue = idetail = b;
+    idestart(b);
+    return;
+  }
+  if(QKEY(b) >= QKEY(idetail)){
+    idetail->qnext = b;
+    idetail = b;
+    return;
+  }
+  // Find b's place, after the bufs of the running command.
+  pp = &idequeue;
+  for(i = 0; i < idecount; i++)
+    pp = &(*pp)->qnext;
+  for(; *pp && QKEY(*pp) <= QKEY(b); pp = &(*pp)->qnext)
     ;
+  b->qnext = *pp;
   *pp = b;
-  
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(b->qnext == 0)
+    idetail = b;
+}
+
+// Like iderw, but return without waiting.  b stays B_BUSY
+// until the disk is done with it; then ideintr releases it.
+void
+iderwasync(struct buf *b)
+{
+  acquire(&idelock);
+  b->flags |= B_ASYNC;
+  ideappend(b);
+  release(&idelock);
+}
+
+// Sync buf with disk. 
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  acquire(&idelock);
+  ideappend(b);
   
   // Wait for request to finish.
   // Assuming will not sleep too long: ignore proc->killed.
@@ -1,34 +1,291 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and the slab allocator.  Allocates 4096-byte pages, or with
+// kalloc_order(), physically contiguous runs of 2^n pages.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "proc.h"
+#include "pstat.h"
+#include "x86.h"
 
 struct run {
   struct run *next;
 };
 
+// Free memory outside the per-CPU magazines below is kept by a
+// binary buddy allocator: kmem.free[k] lists the free blocks of
+// 2^k pages, each aligned to its size.  A freed block is merged
+// with its buddy, the other half of the next larger block, for as
+// long as that is free too.  blkorder[] holds k+1 for the first
+// page of each free block of order k, and 0 for every other page.
+struct block {
+  struct block *next;
+  struct block *prev;
+};
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct block *free[KMAXORDER+1];
+  uint nfree[KMAXORDER+1];
 } kmem;
 
+static uchar *blkorder;
+
+// Each CPU keeps a magazine of up to MAGSIZE free pages, so that
+// most kalloc()s and kfree()s only touch that CPU's own lock.  An
+// empty magazine is refilled with MAGBATCH pages from kmem, and a
+// full one spills MAGBATCH pages back, so kmem.lock is taken at
+// most once every MAGBATCH calls.  Only when kmem is empty too does
+// kalloc() take pages from other CPUs' magazines.
+#define MAGSIZE  32
+#define MAGBATCH 16
+
+struct mag {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;                // Pages in freelist
+  uint hits;            // kalloc()s served from the magazine
+  uint misses;          // kalloc()s that found it empty
+};
+
+static struct mag mags[NCPU];
+
+// Pages that idle CPUs have zeroed ahead of time, so that
+// kalloc_zeroed() does not have to clear them itself.
+#define NZERO 64
+
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} kzero;
+
+// Number of references to each page handed out by kalloc():
+// 1 for most, more for user pages that fork() shares copy-on-write
+// between processes.  kfree() only frees a page when its count
+// drops to 0.  kinit() puts the array, and blkorder[], just after
+// the kernel.
+static volatile int *refcnt;
+
 extern char end[]; // first address after kernel loaded from ELF file
 
+uint phystop;  // end of physical memory; see memsize()
+
+// What a multiboot loader tells us (see multiboot.S), as far as
+// the memory size; 0 if we came through bootmain instead.
+struct mbinfo {
+  uint flags;
+  uint memlower;  // KB from 0, if flags & MB_MEM
+  uint memupper;  // KB from 1MB, if flags & MB_MEM
+} *mbinfo;
+
+#define MB_MEM     0x1
+
+// CMOS memory size registers, as set up by the BIOS.
+#define IO_RTC     0x70
+#define NVRAM_EXT   0x30  // KB above 1MB, up to 64MB
+#define NVRAM_EXT16 0x34  // 64KB units above 16MB
+
+static uint
+nvram(int reg)
+{
+  outb(IO_RTC, reg);
+  return inb(IO_RTC+1);
+}
+
+// Find how much physical memory there is: from the multiboot
+// loader if there is one, otherwise from the CMOS, which the BIOS
+// (and QEMU) fills in.  The memory is assumed contiguous from 1MB.
+static uint
+memsize(void)
+{
+  uint kb, ext, ext16;
+
+  if(mbinfo && (mbinfo->flags & MB_MEM))
+    kb = 1024 + mbinfo->memupper;
+  else {
+    ext = nvram(NVRAM_EXT) | nvram(NVRAM_EXT+1) << 8;
+    ext16 = nvram(NVRAM_EXT16) | nvram(NVRAM_EXT16+1) << 8;
+    if(ext16)
+      kb = 16*1024 + ext16*64;
+    else
+      kb = 1024 + ext;
+  }
+  if(kb > PHYSMAX/1024)
+    kb = PHYSMAX/1024;
+  return (uint)PGROUNDDOWN(kb*1024);
+}
+
+// Put block b of 2^k pages on its free list.
+// Caller must hold kmem.lock.
+static void
+blockinsert(struct block *b, int k)
+{
+  b->prev = 0;
+  b->next = kmem.free[k];
+  if(b->next)
+    b->next->prev = b;
+  kmem.free[k] = b;
+  kmem.nfree[k]++;
+  blkorder[(uint)b/PGSIZE] = k+1;
+}
+
+// Take free block b of 2^k pages off its free list.
+// Caller must hold kmem.lock.
+static void
+blockremove(struct block *b, int k)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    kmem.free[k] = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+  kmem.nfree[k]--;
+  blkorder[(uint)b/PGSIZE] = 0;
+}
+
+// Allocate a block of 2^k pages, splitting a larger one if
+// there is none that size.  Caller must hold kmem.lock.
+static char*
+buddyalloc(int k)
+{
+  struct block *b;
+  int j;
+
+  for(j = k; j <= KMAXORDER && kmem.free[j] == 0; j++)
+    ;
+  if(j > KMAXORDER)
+    return 0;
+  b = kmem.free[j];
+  blockremove(b, j);
+  while(j > k){  // free the upper halves
+    j--;
+    blockinsert((struct block*)((char*)b + (PGSIZE << j)), j);
+  }
+  return (char*)b;
+}
+
+// Free block v of 2^k pages, merging it with free buddies.
+// Caller must hold kmem.lock.
+static void
+buddyfree(char *v, int k)
+{
+  uint pa, buddy;
+
+  pa = (uint)v;
+  for(; k < KMAXORDER; k++){
+    buddy = pa ^ (PGSIZE << k);
+    if(buddy >= phystop || blkorder[buddy/PGSIZE] != k+1)
+      break;
+    blockremove((struct block*)buddy, k);
+    pa &= ~(PGSIZE << k);
+  }
+  blockinsert((struct block*)pa, k);
+}
+
 // Initialize free list of physical pages.
 void
 kinit(void)
 {
   char *p;
+  int i;
 
   initlock(&kmem.lock, "kmem");
-  p = (char*)PGROUNDUP((uint)end);
-  for(; p + PGSIZE <= (char*)PHYSTOP; p += PGSIZE)
-    kfree(p);
+  initlock(&kzero.lock, "kzero");
+  for(i = 0; i < NCPU; i++)
+    initlock(&mags[i].lock, "kmag");
+  phystop = memsize();
+  cprintf("mem: %d MB\n", phystop >> 20);
+  refcnt = (int*)PGROUNDUP((uint)end);
+  memset((void*)refcnt, 0, phystop/PGSIZE*sizeof(int));
+  blkorder = (uchar*)(refcnt + phystop/PGSIZE);
+  memset(blkorder, 0, phystop/PGSIZE);
+  p = (char*)PGROUNDUP((uint)(blkorder + phystop/PGSIZE));
+  for(; p + PGSIZE <= (char*)phystop; p += PGSIZE){
+#ifdef KPOISON
+    memset(p, 1, PGSIZE);
+#endif
+    buddyfree(p, 0);
+  }
+}
+
+// Move up to MAGBATCH pages from kmem to m.
+// Caller must hold m->lock.
+static void
+refill(struct mag *m)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < MAGBATCH && (r = (struct run*)buddyalloc(0)) != 0; i++){
+    r->next = m->freelist;
+    m->freelist = r;
+    m->n++;
+  }
+  release(&kmem.lock);
+}
+
+// Move MAGBATCH pages from m back to kmem.
+// Caller must hold m->lock.
+static void
+spill(struct mag *m)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < MAGBATCH; i++){
+    r = m->freelist;
+    m->freelist = r->next;
+    buddyfree((char*)r, 0);
+  }
+  release(&kmem.lock);
+  m->n -= MAGBATCH;
+}
+
+// Take a page from the pool of zeroed pages, or return 0.
+static struct run*
+zerotake(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0;
+  return r;
+}
+
+// Take a page from any CPU's magazine, when kmem is empty.
+static struct run*
+steal(void)
+{
+  struct mag *m;
+  struct run *r;
+
+  for(m = mags; m < &mags[NCPU]; m++){
+    acquire(&m->lock);
+    r = m->freelist;
+    if(r){
+      m->freelist = r->next;
+      m->n--;
+    }
+    release(&m->lock);
+    if(r)
+      return r;
+  }
+  return 0;
 }
 
 // Free the page of physical memory pointed at by v,
@@ -38,19 +295,67 @@ kinit(void)
 void
 kfree(char *v)
 {
+  struct mag *m;
   struct run *r;
+  int ref;
 
-  if((uint)v % PGSIZE || v < end || (uint)v >= PHYSTOP) 
+  if((uint)v % PGSIZE || v < end || (uint)v >= phystop) 
     panic("kfree");
+  ref = xadd(&refcnt[(uint)v/PGSIZE], -1);
+  if(ref < 1)
+    panic("kfree: not allocated");
+  if(ref > 1)
+    return;  // still shared copy-on-write
 
+#ifdef KPOISON
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  pushcli();
+  m = &mags[cpu->id];
+  acquire(&m->lock);
+  if(m->n == MAGSIZE)
+    spill(m);
+  r->next = m->freelist;
+  m->freelist = r;
+  m->n++;
+  release(&m->lock);
+  popcli();
+}
+
+// Take a free page from this CPU's magazine, or from anywhere
+// else but the zeroed pool.  If count is set, charge the
+// magazine's hit and miss counters; kzerofill() does not, so
+// that idle-time zeroing is not reported as allocations.
+static struct run*
+allocpage(int count)
+{
+  struct mag *m;
+  struct run *r;
+
+  pushcli();
+  m = &mags[cpu->id];
+  acquire(&m->lock);
+  if(m->freelist){
+    if(count)
+      m->hits++;
+  } else {
+    if(count)
+      m->misses++;
+    refill(m);
+  }
+  r = m->freelist;
+  if(r){
+    m->freelist = r->next;
+    m->n--;
+  }
+  release(&m->lock);
+  popcli();
+  if(r == 0)
+    r = steal();
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -61,11 +366,122 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
+  if((r = allocpage(1)) == 0)
+    r = zerotake();
   if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+    refcnt[(uint)r/PGSIZE] = 1;
   return (char*)r;
 }
 
+// Allocate a page of physical memory filled with zeros,
+// preferably one that an idle CPU has already cleared.
+char*
+kalloc_zeroed(void)
+{
+  char *v;
+
+  if((v = (char*)zerotake()) != 0){
+    refcnt[(uint)v/PGSIZE] = 1;
+    return v;
+  }
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Zero one free page for kalloc_zeroed().  Called by the scheduler
+// when it has nothing to run.  Returns 0 if there was nothing to
+// do, because the pool is full or memory has run out.
+int
+kzerofill(void)
+{
+  struct run *r;
+
+  // Unlocked: a few CPUs may overfill the pool slightly.
+  if(kzero.n >= NZERO)
+    return 0;
+  if((r = allocpage(0)) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+  acquire(&kzero.lock);
+  r->next = kzero.freelist;
+  kzero.freelist = r;
+  kzero.n++;
+  release(&kzero.lock);
+  return 1;
+}
+
+// Add a reference to page v, which kfree() will have to drop
+// before the page is really freed.
+void
+kref(char *v)
+{
+  xadd(&refcnt[(uint)v/PGSIZE], 1);
+}
+
+// Number of references to page v.
+int
+krefs(char *v)
+{
+  return refcnt[(uint)v/PGSIZE];
+}
+
+// Allocate 2^n physically contiguous pages, aligned to their
+// size, straight from the buddy lists.  kalloc() is the fast
+// path for n = 0.  Returns 0 if the memory cannot be allocated.
+char*
+kalloc_order(int n)
+{
+  char *v;
+
+  if(n < 0 || n > KMAXORDER)
+    return 0;
+  if(n == 0)
+    return kalloc();
+  acquire(&kmem.lock);
+  v = buddyalloc(n);
+  release(&kmem.lock);
+  if(v)
+    refcnt[(uint)v/PGSIZE] = 1;
+  return v;
+}
+
+// Free 2^n pages that kalloc_order(n) returned.
+void
+kfree_order(char *v, int n)
+{
+  if(n == 0){
+    kfree(v);
+    return;
+  }
+  if(n < 0 || n > KMAXORDER || (uint)v % (PGSIZE << n) ||
+     v < end || (uint)v + (PGSIZE << n) > phystop)
+    panic("kfree_order");
+  if(xadd(&refcnt[(uint)v/PGSIZE], -1) != 1)
+    panic("kfree_order: not allocated");
+
+#ifdef KPOISON
+  memset(v, 1, PGSIZE << n);
+#endif
+
+  acquire(&kmem.lock);
+  buddyfree(v, n);
+  release(&kmem.lock);
+}
+
+// Report each CPU's magazine hits and misses, and how
+// fragmented the buddy allocator's free memory is.
+void
+kallocstat(struct cpustat *cs)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++){
+    cs->kallochits[i] = mags[i].hits;
+    cs->kallocmisses[i] = mags[i].misses;
+  }
+  acquire(&kmem.lock);
+  for(i = 0; i <= KMAXORDER; i++)
+    cs->freeblocks[i] = kmem.nfree[i];
+  release(&kmem.lock);
+}
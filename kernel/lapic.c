@@ -3,6 +3,7 @@
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
 #include "traps.h"
 #include "mmu.h"
 #include "x86.h"
@@ -14,6 +15,7 @@
 #define EOI     (0x00B0/4)   // EOI
 #define SVR     (0x00F0/4)   // Spurious Interrupt Vector
   #define ENABLE     0x00000100   // Unit Enable
+#define IRR     (0x0200/4)   // Interrupt Request (8 registers)
 #define ESR     (0x0280/4)   // Error Status
 #define ICRLO   (0x0300/4)   // Interrupt Command
   #define INIT       0x00000500   // INIT/RESET
@@ -39,6 +41,7 @@
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
 volatile uint *lapic;  // Initialized in mp.c
+uint lapicticr;        // Timer counts per clock tick
 
 static void
 lapicw(int index, int value)
@@ -59,11 +62,10 @@ lapicinit(int c)
 
   // The timer repeatedly counts down at bus frequency
   // from lapic[TICR] and then issues an interrupt.  
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // TICR is calibrated against the PIT by clockinit(), which
+  // starts the boot processor's timer; until then it is stopped.
   lapicw(TDCR, X1);
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000); 
+  lapicperiodic();
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -122,6 +124,61 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send interrupt vector to the CPU with the given local APIC id.
+// Caller must have interrupts disabled, so that the two halves
+// of the interrupt command are not split by an interrupt handler
+// sending its own IPI.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
+// Make this CPU's timer interrupt HZ times a second.
+void
+lapicperiodic(void)
+{
+  if(!lapic)
+    return;
+  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, lapicticr);
+}
+
+// Make this CPU's timer interrupt once, count timer counts from
+// now, instead of periodically.  A count of 0 stops the timer.
+void
+lapiconeshot(uint count)
+{
+  if(!lapic)
+    return;
+  lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+  lapicw(TICR, count);
+}
+
+// Timer counts left before this CPU's next timer interrupt.
+uint
+lapiccount(void)
+{
+  if(!lapic)
+    return 0;
+  return lapic[TCCR];
+}
+
+// Is the interrupt with the given vector waiting to be delivered
+// to this CPU?
+int
+lapicpending(int vector)
+{
+  if(!lapic)
+    return 0;
+  return (lapic[IRR + (vector/32)*4] >> (vector%32)) & 1;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
@@ -19,6 +19,7 @@ main(void)
 {
   mpinit();        // collect info about this machine
   lapicinit(mpbcpu());
+  clockinit();     // calibrate the TSC and local APIC timer
   seginit();       // set up segments
   kinit();         // initialize memory allocator
   jmpkstack();       // call mainc() on a properly-allocated stack 
@@ -52,6 +53,7 @@ mainc(void)
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  pipeinit();      // pipe cache
   iinit();         // inode cache
   ideinit();       // disk
   if(!ismp)
@@ -62,6 +64,7 @@ mainc(void)
   cinit();
   sti();           // enable inturrupts
   userinit();      // first user process
+  kproc("flusher", flusher);  // buffer cache write-back
   scheduler();     // start running processes
 }
 
@@ -75,6 +78,7 @@ cinit(void) {
   vmenable();        // turn on paging
   cprintf("cpu%d: starting\n", cpu->id);
   idtinit();       // load idt register
+  sysenterinit();  // fast system call entry
   xchg(&cpu->booted, 1); // tell bootothers() we're up
 }
 
@@ -13,9 +13,11 @@ KERNEL_OBJECTS := \
 	lapic.o\
 	main.o\
 	mp.o\
+	pci.o\
 	picirq.o\
 	pipe.o\
 	proc.o\
+	slab.o\
 	spinlock.o\
 	string.o\
 	swtch.o\
@@ -39,6 +39,20 @@
 #define CR0_CD		0x40000000	// Cache Disable
 #define CR0_PG		0x80000000	// Paging
 
+// Control Register 4 flags
+#define CR4_PSE		0x00000010	// Page Size Extensions
+#define CR4_PGE		0x00000080	// Page Global Enable
+
+// CPUID function 1 %edx feature flags
+#define CPUID_PSE	0x00000008	// 4MB pages
+#define CPUID_SEP	0x00000800	// sysenter and sysexit
+#define CPUID_PGE	0x00002000	// global pages
+
+// Model specific registers
+#define MSR_SYSENTER_CS		0x174	// sysenter %cs (and %ss, %cs+8)
+#define MSR_SYSENTER_ESP	0x175	// sysenter %esp
+#define MSR_SYSENTER_EIP	0x176	// sysenter %eip
+
 // Segment Descriptor
 struct segdesc {
   uint lim_15_0 : 16;  // Low bits of segment limit
@@ -118,6 +132,7 @@ struct segdesc {
 
 #define PGSIZE		4096		// bytes mapped by a page
 #define PGSHIFT		12		// log2(PGSIZE)
+#define PTSIZE		(PGSIZE*NPTENTRIES)	// bytes mapped by a page directory entry
 
 #define PTXSHIFT	12		// offset of PTX in a linear address
 #define PDXSHIFT	22		// offset of PDX in a linear address
@@ -134,10 +149,13 @@ struct segdesc {
 #define PTE_A		0x020	// Accessed
 #define PTE_D		0x040	// Dirty
 #define PTE_PS		0x080	// Page Size
+#define PTE_G		0x100	// Global
 #define PTE_MBZ		0x180	// Bits must be zero
+#define PTE_COW		0x200	// Copy-on-write (available for software use)
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)	((uint)(pte) & ~0xFFF)
+#define PTE_FLAGS(pte)	((uint)(pte) &  0xFFF)
 
 typedef uint pte_t;
 
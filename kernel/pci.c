@@ -0,0 +1,58 @@
+// PCI configuration space, through configuration mechanism #1.
+// Just enough to find a device by class and set it up:
+// only bus 0 is searched, which is where the chipset's own
+// devices (such as the PIIX IDE controller) live.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+
+#define PCI_CONFADDR  0xcf8
+#define PCI_CONFDATA  0xcfc
+
+#define PCI_ID        0x00  // Register: device id << 16 | vendor id
+#define PCI_CLASS     0x08  // Register: class, subclass, prog-if, revision
+#define PCI_HDRTYPE   0x0c  // Register: header type in bits 16-23
+
+#define PCIADDR(dev, func, reg) \
+  (0x80000000 | ((dev)<<11) | ((func)<<8) | ((reg) & 0xfc))
+
+// Read register reg of PCI function pf (as returned by pcifind).
+uint
+pciread(int pf, int reg)
+{
+  outl(PCI_CONFADDR, pf | PCIADDR(0, 0, reg));
+  return inl(PCI_CONFDATA);
+}
+
+void
+pciwrite(int pf, int reg, uint v)
+{
+  outl(PCI_CONFADDR, pf | PCIADDR(0, 0, reg));
+  outl(PCI_CONFDATA, v);
+}
+
+// Find the first PCI function on bus 0 with the given class
+// and subclass.  Returns it as a handle for pciread/pciwrite,
+// or -1 if there is none.
+int
+pcifind(int class, int subclass)
+{
+  int dev, func, nfunc, pf;
+  uint c;
+
+  for(dev = 0; dev < 32; dev++){
+    nfunc = 1;
+    for(func = 0; func < nfunc; func++){
+      pf = (dev<<11) | (func<<8);
+      if((pciread(pf, PCI_ID) & 0xffff) == 0xffff)
+        continue;
+      if(func == 0 && (pciread(pf, PCI_HDRTYPE) & 0x800000))
+        nfunc = 8;  // multi-function device
+      c = pciread(pf, PCI_CLASS);
+      if((c >> 24) == class && ((c >> 16) & 0xff) == subclass)
+        return pf;
+    }
+  }
+  return -1;
+}
@@ -6,6 +6,7 @@
 #include "fs.h"
 #include "file.h"
 #include "spinlock.h"
+#include "slab.h"
 
 #define PIPESIZE 512
 
@@ -18,6 +19,14 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+static struct kcache pipecache;
+
+void
+pipeinit(void)
+{
+  kcacheinit(&pipecache, "pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -27,7 +36,7 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = kcache_alloc(&pipecache)) == 0)
     goto bad;
   p->readopen = 1;
   p->writeopen = 1;
@@ -46,7 +55,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(p)
-    kfree((char*)p);
+    kcache_free(&pipecache, p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -67,7 +76,7 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    kcache_free(&pipecache, p);
   } else
     release(&p->lock);
 }
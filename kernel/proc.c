@@ -3,21 +3,29 @@
 #include "param.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
 #include "proc.h"
+#include "sysinfo.h"
 #include "spinlock.h"
+#include "slab.h"
 #include "pstat.h"
 
+// Sleeping processes are hashed by channel, so wakeup() only looks
+// at processes that might be sleeping on the channel it was given.
+#define SLEEPQSHIFT 6
+#define NSLEEPQ     (1 << SLEEPQSHIFT)
 
+// Processes are allocated from a slab cache as they are created,
+// up to NPROC at a time, and linked on ptable.list.  Each holds
+// one of NPROC slot numbers, its index in getpinfo()'s pstat.
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct proc *list;             // chains through proc->pnext/pprev
+  uint slots[(NPROC+31)/32];     // bit set for each slot in use
+  struct kcache cache;
+  struct proc *sleepq[NSLEEPQ];  // chains through proc->snext/sprev
 } ptable;
 
-typedef struct q{
-    struct proc* p;
-    struct q* next;
-} q;
-
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -26,34 +34,41 @@ extern void trapret(void);
 
 static void wakeup1(void *chan);
 
-void dequeue(struct proc** pq, int pq_num, int index);
-int check_promote(struct proc* proc);
-
-// 4 level priorities
-struct proc* lv0[NPROC];
-struct proc* lv1[NPROC];
-struct proc* lv2[NPROC];
-struct proc* lv3[NPROC];
-// number of proc in each queue
-int lv0_num = 0;
-int lv1_num = 0;
-int lv2_num = 0;
-int lv3_num = 0;
-// initial time ticks
-const int LV1_TIME = 32;
-const int LV2_TIME = 16;
-const int LV3_TIME = 8;
-
-int q_pri = 3;
+static void setrunnable(struct proc *p);
+
+// time slices, in microseconds
+const int LV1_TIME = 320000;
+const int LV2_TIME = 160000;
+const int LV3_TIME = 80000;
 
 void
 pinit(void)
 {
+  struct cpu *c;
+
   initlock(&ptable.lock, "ptable");
+  kcacheinit(&ptable.cache, "proc", sizeof(struct proc));
+  for(c = cpus; c < cpus+NCPU; c++)
+    initlock(&c->rqlock, "runq");
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, change state to EMBRYO and initialize
+// Take p off the process list and free it.
+// The ptable lock must be held.
+static void
+freeproc(struct proc *p)
+{
+  if(p->pprev)
+    p->pprev->pnext = p->pnext;
+  else
+    ptable.list = p->pnext;
+  if(p->pnext)
+    p->pnext->pprev = p->pprev;
+  ptable.slots[p->slot/32] &= ~(1 << (p->slot%32));
+  kcache_free(&ptable.cache, p);
+}
+
+// Allocate a proc and put it on the process list.
+// If possible, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
 static struct proc*
@@ -61,15 +76,24 @@ allocproc(void)
 {
   struct proc *p;
   char *sp;
+  int slot;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-  release(&ptable.lock);
-  return 0;
+  for(slot = 0; slot < NPROC; slot++)
+    if(!(ptable.slots[slot/32] & (1 << (slot%32))))
+      break;
+  if(slot == NPROC || (p = kcache_alloc(&ptable.cache)) == 0){
+    release(&ptable.lock);
+    return 0;
+  }
+  ptable.slots[slot/32] |= 1 << (slot%32);
+  p->slot = slot;
+  p->pprev = 0;
+  p->pnext = ptable.list;
+  if(ptable.list)
+    ptable.list->pprev = p;
+  ptable.list = p;
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
 // /*
@@ -79,21 +103,29 @@ found:
       p -> ticks[i] = 0;
       p -> wait_ticks[i] = 0;
       p -> ticks_op[i] = 0;
-      p -> wait_ticks_op[i] = 0;
   }
-  /*
-  // we add newly arrived proc to q3
-  lv3[lv3_num] = p;
-  lv3_num++;
-  // */
+  p->qnext = 0;
+  p->qprev = 0;
+  p->anext = 0;
+  p->aprev = 0;
 
   release(&ptable.lock);
 
-  // Allocate kernel stack if possible.
+  // Allocate kernel stack and info page if possible.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
+  if((p->info = (struct procinfo*)kalloc_zeroed()) == 0){
+    kfree(p->kstack);
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
+    return 0;
+  }
+  p->info->pid = p->pid;
   sp = p->kstack + KSTACKSIZE;
   
   // Leave room for trap frame.
@@ -123,7 +155,7 @@ userinit(void)
   p = allocproc();
   acquire(&ptable.lock);
   initproc = p;
-  if((p->pgdir = setupkvm()) == 0)
+  if((p->pgdir = setupkvm()) == 0 || mapprocinfo(p->pgdir, p->info) < 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
@@ -139,25 +171,35 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
-  /*
-  //modified for MLFQ
-  p -> priority = 3;
-  for(int i = 0; i < NLAYER; ++i){
-      p -> ticks[i] = 0;
-      p -> wait_ticks[i] = 0;
-  }
-  */
   // we add newly arrived proc to q3
-  lv3[lv3_num] = p;
-  lv3_num++;
- //
- //*/ 
+  p->qcpu = cpu;
+  setrunnable(p);
+
+  release(&ptable.lock);
+}
+
+// Start a kernel process that runs fn, which must not return.
+// It has only the kernel's mappings and never enters user space.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+    panic("kproc");
+  // Have forkret return to fn instead of trapret.
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
 
+  acquire(&ptable.lock);
+  p->qcpu = cpu;
+  setrunnable(p);
   release(&ptable.lock);
 }
 
 // Grow current process's memory by n bytes.
+// Growth only reserves the address space: each new page is
+// allocated, zeroed, when it is first touched (pagefault).
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -166,14 +208,14 @@ growproc(int n)
   
   sz = proc->sz;
   if(n > 0){
-    if((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0)
+    if(sz + n > USERTOP || sz + n < sz)
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(proc->pgdir, sz, sz + n)) == 0)
       return -1;
   }
   proc->sz = sz;
-  switchuvm(proc);
   return 0;
 }
 
@@ -191,10 +233,15 @@ fork(void)
     return -1;
 
   // Copy process state from p.
-  if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0){
+  if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0 ||
+     mapprocinfo(np->pgdir, np->info) < 0){
+    if(np->pgdir)
+      freevm(np->pgdir);
     kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+    kfree((char*)np->info);
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
   np->sz = proc->sz;
@@ -210,20 +257,14 @@ fork(void)
   np->cwd = idup(proc->cwd);
  
   pid = np->pid;
-  np->state = RUNNABLE;
-  /*
-  //modified for MLFQ
-  np -> priority = 3;
-  for(int i = 0; i < NLAYER; ++i){
-      np -> ticks[i] = 0;
-      np -> wait_ticks[i] = 0;
-  }
-  */
-  // we add newly arrived proc to q3
-  lv3[lv3_num] = np;
-  lv3_num++;
-
   safestrcpy(np->name, proc->name, sizeof(proc->name));
+
+  acquire(&ptable.lock);
+  // we add newly arrived proc to q3 of this CPU; idle CPUs
+  // will steal it if this one is busy
+  np->qcpu = cpu;
+  setrunnable(np);
+  release(&ptable.lock);
   return pid;
 }
 
@@ -256,7 +297,7 @@ exit(void)
   wakeup1(proc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.list; p; p = p->pnext){
     if(p->parent == proc){
       p->parent = initproc;
       if(p->state == ZOMBIE)
@@ -282,7 +323,7 @@ wait(void)
   for(;;){
     // Scan through table looking for zombie children.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    for(p = ptable.list; p; p = p->pnext){
       if(p->parent != proc)
         continue;
       havekids = 1;
@@ -290,13 +331,9 @@ wait(void)
         // Found one.
         pid = p->pid;
         kfree(p->kstack);
-        p->kstack = 0;
+        kfree((char*)p->info);
         freevm(p->pgdir);
-        p->state = UNUSED;
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
+        freeproc(p);
         release(&ptable.lock);
         return pid;
       }
@@ -313,85 +350,305 @@ wait(void)
   }
 }
 
-// update the waitting time of other process
-int
-check_promote(struct proc* proc){
-    // we clear the proc's waitting time before intering the routine
-    // The wait time of proc shouldn't be incremented at all
-    // However, for simplicity, the procs wait_ticks will be incremented to one with following loops
-    // Which doesn't matter since time_ticks == 1 doesn't trigger any promotion
-    // We clear the proc's waiting time again when exitting the routine to compensate it
-    
-    // update lv3, no need to promoted
-    for(int i = 0; i < lv3_num; ++i){
-        (lv3[i] -> wait_ticks[3])++;
-        (lv3[i] -> wait_ticks_op[3])++;
-    }
+// MLFQ run queues.
+//
+// Every CPU has its own set of NLAYER run queues, protected by
+// its own rqlock, so picking a process never touches ptable.lock
+// or another CPU's queues.  Each level is a doubly-linked list
+// threaded through proc->qnext/qprev, and bit i of c->runqmask is
+// set while c->runq[i] is non-empty.  Queued processes of each
+// level are also kept on c->agelist in enqueue-time order (through
+// proc->anext/aprev); every process joins at the tail stamped with
+// the current tick, so the head has the earliest promotion deadline.
+//
+// A runnable process is queued on p->qcpu, the CPU it last ran
+// on.  A CPU whose queues are empty steals from the busiest peer,
+// and the stolen process is queued on the thief from then on.
+//
+// Lock order is ptable.lock, then at most one rqlock.  The
+// functions below up to age() must be called with c->rqlock held.
+
+// Start p's wait at its current level: stamp it with the current
+// tick and append it to that level's aging list.
+static void
+agestart(struct cpu *c, struct proc *p)
+{
+  struct runq *q;
+
+  p->enqtick = ticks;
+  q = &c->agelist[p->priority];
+  p->anext = 0;
+  p->aprev = q->tail;
+  if(q->tail)
+    q->tail->anext = p;
+  else
+    q->head = p;
+  q->tail = p;
+}
 
-    // update lv2
-    for(int i = 0; i < lv2_num; ++i){
-        (lv2[i] -> wait_ticks[2])++;
-        (lv2[i] -> wait_ticks_op[2])++;
-        // if the wait time is greater than 10 * LV2_TIME, promote
-        if( (lv2[i] -> wait_ticks_op[2]) >= 10 * LV2_TIME ){
-            (lv2[i] -> priority)++;
-            cprintf("lv2 promote to lv3\n");
-            // clear ticks and wait_ticks of the prev priority
-            (lv2[i] -> ticks_op[2]) = 0;
-            (lv2[i] -> wait_ticks_op[2]) = 0;
-            // remove process from lv2, put it to lv3
-            lv3[lv3_num] = lv2[i];
-            lv3_num++;
-            dequeue(lv2, lv2_num, i);
-            lv2_num--;
-        }
-    }
-    // update lv1
-    for(int i = 0; i < lv1_num; ++i){
-        (lv1[i] -> wait_ticks[1])++;
-        (lv1[i] -> wait_ticks_op[1])++;
-        // if the wait time is greater than 10 * LV1_TIME, promote
-        if( (lv1[i] -> wait_ticks_op[1]) >= 10 * LV1_TIME ){
-            (lv1[i] -> priority)++;
-            // clear ticks and wait_ticks of the prev priority
-            (lv1[i] -> ticks_op[1]) = 0;
-            (lv1[i] -> wait_ticks_op[1]) = 0;
-            // remove process from lv1, put it to lv2
-            lv2[lv2_num] = lv1[i];
-            lv2_num++;
-            dequeue(lv1, lv1_num, i);
-            lv1_num--;
-        }
-    }
-    // update lv0
-    for(int i = 0; i < lv0_num; ++i){
-        (lv0[i] -> wait_ticks[0])++;
-        (lv0[i] -> wait_ticks_op[0])++;
-        // if the wait time is greater than 500, promote
-        if( (lv0[i] -> wait_ticks_op[0]) >= 500 ){
-            (lv0[i] -> priority)++;
-            // clear ticks and wait_ticks of the prev priority
-            (lv0[i] -> ticks_op[0]) = 0;
-            (lv0[i] -> wait_ticks_op[0]) = 0;
-            // remove process from lv0, put it to lv1
-            lv1[lv1_num] = lv0[i];
-            lv1_num++;
-            dequeue(lv0, lv0_num, i);
-            lv0_num--;
-        }
+// End p's wait at its current level, folding the ticks it spent
+// queued into wait_ticks.
+static void
+agestop(struct cpu *c, struct proc *p)
+{
+  struct runq *q;
+
+  p->wait_ticks[p->priority] += ticks - p->enqtick;
+  p->enqtick = ticks;
+  q = &c->agelist[p->priority];
+  if(p->aprev)
+    p->aprev->anext = p->anext;
+  else
+    q->head = p->anext;
+  if(p->anext)
+    p->anext->aprev = p->aprev;
+  else
+    q->tail = p->aprev;
+  p->anext = 0;
+  p->aprev = 0;
+}
+
+// Append p to the tail of c's run queue for its priority.
+static void
+enqueue(struct cpu *c, struct proc *p)
+{
+  struct runq *q;
+
+  q = &c->runq[p->priority];
+  p->qnext = 0;
+  p->qprev = q->tail;
+  if(q->tail)
+    q->tail->qnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+  c->runqmask |= 1 << p->priority;
+  c->nrunq++;
+  agestart(c, p);
+}
+
+// Put p back at the head of c's run queue for its priority,
+// so it is the next process picked at that level.
+static void
+enqueuehead(struct cpu *c, struct proc *p)
+{
+  struct runq *q;
+
+  q = &c->runq[p->priority];
+  p->qprev = 0;
+  p->qnext = q->head;
+  if(q->head)
+    q->head->qprev = p;
+  else
+    q->tail = p;
+  q->head = p;
+  c->runqmask |= 1 << p->priority;
+  c->nrunq++;
+  agestart(c, p);
+}
+
+// Unlink p from c's run queue for its priority.
+static void
+dequeue(struct cpu *c, struct proc *p)
+{
+  struct runq *q;
+
+  q = &c->runq[p->priority];
+  if(p->qprev)
+    p->qprev->qnext = p->qnext;
+  else
+    q->head = p->qnext;
+  if(p->qnext)
+    p->qnext->qprev = p->qprev;
+  else
+    q->tail = p->qprev;
+  p->qnext = 0;
+  p->qprev = 0;
+  if(q->head == 0)
+    c->runqmask &= ~(1 << p->priority);
+  c->nrunq--;
+  agestop(c, p);
+}
+
+// Take the head of c's highest non-empty level off its queue.
+// Returns 0 if c has nothing queued.
+static struct proc*
+runqtake(struct cpu *c)
+{
+  struct proc *p;
+
+  if(c->runqmask == 0)
+    return 0;
+  p = c->runq[bsr(c->runqmask)].head;
+  dequeue(c, p);
+  return p;
+}
+
+// Convert microseconds to clock ticks, rounding up.
+static int
+ustoticks(int us)
+{
+  return (us + 1000000/HZ - 1) / (1000000/HZ);
+}
+
+// Number of ticks a process may run at each level before it is
+// demoted.  Level 0 is FIFO and never demotes.
+static int
+quantum(int lv)
+{
+  switch(lv){
+  case 3: return ustoticks(LV3_TIME);
+  case 2: return ustoticks(LV2_TIME);
+  case 1: return ustoticks(LV1_TIME);
+  }
+  return 0;
+}
+
+// Number of ticks a process may wait at each level before it is
+// promoted.  Level 3 is the top and never promotes.
+static int
+agelimit(int lv)
+{
+  switch(lv){
+  case 2: return ustoticks(10 * LV2_TIME);
+  case 1: return ustoticks(10 * LV1_TIME);
+  case 0: return ustoticks(5000000);
+  }
+  return 0;
+}
+
+// Promote every process queued on c whose wait at its level has
+// reached agelimit().  Waits are never counted tick by tick: a
+// process's wait is now - enqtick, and since each aging list is in
+// enqtick order only the expired heads need to be looked at, so
+// the cost is O(levels + promotions) however many are runnable.
+static void
+age(struct cpu *c)
+{
+  struct proc *p;
+  uint now;
+  int lv;
+
+  now = ticks;
+  for(lv = NLAYER-2; lv >= 0; lv--){
+    while((p = c->agelist[lv].head) != 0 &&
+          now - p->enqtick >= agelimit(lv)){
+      if(lv == 2)
+        cprintf("lv2 promote to lv3\n");
+      // clear ticks of the prev priority
+      p -> ticks_op[lv] = 0;
+      // remove process from lv, put it to lv+1
+      dequeue(c, p);
+      (p -> priority)++;
+      enqueue(c, p);
     }
-    
-    return 0; 
+  }
+}
 
+// Wake a CPU halted in idle() so it can run a newly queued
+// process: c itself if it is idle, otherwise any idle CPU, which
+// will steal the process from c.  Interrupts must be disabled.
+static void
+kick(struct cpu *c)
+{
+  struct cpu *i;
+
+  if(!c->idle){
+    for(i = cpus; i < cpus+ncpu; i++)
+      if(i->idle)
+        break;
+    if(i == cpus+ncpu)
+      return;
+    c = i;
+  }
+  // An idle current CPU is in an interrupt handler and will
+  // look at its queues as soon as the handler returns.
+  if(c != cpu)
+    lapicipi(c->id, T_IRQ0 + IRQ_WAKEUP);
 }
 
+// Mark p RUNNABLE and append it to the run queue of p->qcpu.
+// The ptable lock must be held.
+static void
+setrunnable(struct proc *p)
+{
+  struct cpu *c;
 
+  c = p->qcpu;
+  acquire(&c->rqlock);
+  p->state = RUNNABLE;
+  enqueue(c, p);
+  release(&c->rqlock);
+  kick(c);
+}
 
-void
-dequeue(struct proc** pq, int pq_num, int index){
-    pq_num--;
-    for(int i = index; i < pq_num; ++i)
-        pq[i] = pq[i+1];
+// Is any process queued on any CPU?
+static int
+anyqueued(void)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c->nrunq > 0)
+      return 1;
+  return 0;
+}
+
+// Halt this CPU until an interrupt arrives, rather than spinning on
+// the run queue locks.  The idle flag is published before the queues
+// are checked and setrunnable() queues a process before it reads the
+// flag, so a process queued after the check always gets us a wakeup
+// IPI.  An IPI that arrives before the hlt is held pending by the cli.
+// The clock interrupt is stopped while we are halted; see timer.c.
+static void
+idle(void)
+{
+  uint64 t0;
+
+  cli();
+  xchg(&cpu->idle, 1);
+  if(cpu->nrunq == 0 && !anyqueued()){
+    t0 = rdtsc();
+    timeridle();
+    stihlt();
+    cli();
+    timerbusy();
+    cpu->idlecycles += rdtsc() - t0;
+  }
+  cpu->idle = 0;
+  sti();
+}
+
+// Pick the next process for this CPU and take it off its queue:
+// the best process queued here, or failing that the best process
+// queued on the CPU with the most queued processes.
+// The busiest CPU is chosen from unlocked reads of nrunq; that is
+// only a hint, and runqtake() rechecks under the victim's lock.
+static struct proc*
+pickproc(void)
+{
+  struct cpu *c, *victim;
+  struct proc *p;
+
+  acquire(&cpu->rqlock);
+  p = runqtake(cpu);
+  release(&cpu->rqlock);
+  if(p)
+    return p;
+
+  victim = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c == cpu || c->nrunq == 0)
+      continue;
+    if(victim == 0 || c->nrunq > victim->nrunq)
+      victim = c;
+  }
+  if(victim == 0)
+    return 0;
+  acquire(&victim->rqlock);
+  p = runqtake(victim);
+  release(&victim->rqlock);
+  return p;
 }
 
 // Per-CPU process scheduler.
@@ -401,281 +658,89 @@ dequeue(struct proc** pq, int pq_num, int index){
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
+//
+// The process to run is the head of the highest non-empty level
+// of this CPU's queues, found with a single bsr on runqmask, or
+// one stolen from another CPU (see pickproc).  It is off every
+// queue while it runs and is put back on this CPU afterwards: at
+// the tail of lv3 (round robin), at the head of lv2..lv0 (it
+// keeps the CPU until its quantum is used up), or at the tail
+// of the next level down if its quantum expired.  A process that
+// is picked again straight away keeps its address space loaded.
 void
 scheduler(void)
 {
+  struct proc *p;
+  int lv, demoted, again;
+
+  cpu->tsc0 = rdtsc();
   for(;;){
-      // Enable interrupts on this processor.
+    // Enable interrupts on this processor.
     sti();
 
-    
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-   // for(//in ptatble){
-        // if you find a runnable
-        // add to lv3
-    
-    //}
-    // search four priority queue until find a runnable proc
-    // search lv3 first
-    // if find, execute 
-    // After exexuting, goto the start of the proc search (start from lv3)
-    SEARCH:
-    while(lv3_num > 0){
-
-    for(int lv3i = 0; lv3i < lv3_num; lv3i++){
-         // Switch to chosen process.  It is the process's job
-         // to release ptable.lock and then reacquire it
-         // before jumping back to us.
-            //int temp_ticks = 0;
-            proc = lv3[lv3i];
-            switchuvm(lv3[lv3i]);
-            lv3[lv3i]->state = RUNNING;
-            swtch(&cpu->scheduler, proc->context);
-            switchkvm();
-            // kernel regain control
-            // 
-            // clear the wait time for proc
-            lv3[lv3i] -> wait_ticks_op[3] = 0;
-            lv3[lv3i] -> wait_ticks[3] = 0;
-            // update wait time for other proc
-            check_promote(lv3[lv3i]);
-            // increment wait by 1 (See check_promote routine)
-            lv3[lv3i] -> wait_ticks_op[3] = 0;
-            lv3[lv3i] -> wait_ticks[3] = 0;
-
-            // increment ticks
-            //cprintf("[PID %d] has done running on level 3, ticks %d\n ", pp -> pid, pp -> ticks[3]);
-            (lv3[lv3i] -> ticks_op[3])++;
-            (lv3[lv3i] -> ticks[3])++;
-
-            /*
-            // check if proc is not RUNNABLE
-            // if not, deque from lv3
-            if(lv3[lv3i] -> state != RUNNABLE){
-                dequeue(lv3, lv3_num, lv3i);
-                lv3_num--;
-                proc = 0;
-                continue;
-            }
-            */
-
-            if( (lv3[lv3i] -> ticks_op[3]) >= LV3_TIME){
-                lv3[lv3i] -> priority = 2;
-                lv3[lv3i] -> ticks_op[3] = 0;
-                lv3[lv3i] -> wait_ticks_op[3] = 0;
-                lv3[lv3i] -> wait_ticks[3] = 0;
-                // check if proc is not RUNNABLE
-                // if not, deque from lv3
-                if(lv3[lv3i] -> state != RUNNABLE){
-                    dequeue(lv3, lv3_num, lv3i);
-                    lv3_num--;
-                    proc = 0;
-                    continue;
-                }
-                // add the proc to lv2
-                // remove the proc from lv3
-                lv2[lv2_num] = lv3[lv3i];
-                lv2_num++;
-                dequeue(lv3, lv3_num, lv3i);
-                lv3_num--;
-                //
-            }
-            // check if proc is not RUNNABLE
-            // if not, deque from lv3
-            else if(lv3[lv3i] -> state != RUNNABLE){
-                dequeue(lv3, lv3_num, lv3i);
-                lv3_num--;
-            }
-         // Process is done running for now.
-         // It should have changed its p->state before coming back.
-         //
-         proc = 0;
-         //search again
-    }
-    }
-    while(lv2_num > 0){
-    for(int lv2i = 0; lv2i < lv2_num; lv2i++ ){
-        // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
-           proc = lv2[lv2i];
-           switchuvm(lv2[lv2i]);
-           lv2[lv2i]->state = RUNNING;
-           swtch(&cpu->scheduler, proc->context);
-           switchkvm();
-           // kernel regain control
-           // 
-           // clear the wait time for proc
-           lv2[lv2i] -> wait_ticks_op[2] = 0;
-           lv2[lv2i] -> wait_ticks[2] = 0;
-           // update wait time for other proc
-           check_promote(lv2[lv2i]);
-           // increment wait by 1 (See check_promote routine)
-           lv2[lv2i] -> wait_ticks_op[2] = 0;
-           lv2[lv2i] -> wait_ticks[2] = 0;
-           // increment ticks
-           (lv2[lv2i] -> ticks_op[2])++;
-           (lv2[lv2i] -> ticks[2])++;
-           // check if proc is not RUNNABLE
-           // if not, deque from lv1
-           /*
-           if(lv2[lv2i] -> state != RUNNABLE){
-                dequeue(lv2, lv2_num, lv2i);
-                lv2_num--;
-                proc = 0;
-                goto SEARCH;
-           }
-           */
-
-           if( (lv2[lv2i] -> ticks_op[2]) >= LV2_TIME){
-               // de-mote proc priority
-               lv2[lv2i] -> priority = 1;
-               lv2[lv2i] -> ticks_op[2] = 0;
-               lv2[lv2i] -> wait_ticks_op[2] = 0;
-               lv2[lv2i] -> wait_ticks[2] = 0;
-               // check if proc is not RUNNABLE
-               // if not, deque from lv2
-               if(lv2[lv2i] -> state != RUNNABLE){
-                   dequeue(lv2, lv2_num, lv2i);
-                   lv2_num--;
-                   proc = 0;
-                   continue;
-               }
-               // add the proc to lv1
-               // remove the proc from lv2
-               lv1[lv1_num] = lv2[lv2i];
-               lv1_num++;
-               dequeue(lv2, lv2_num, lv2i);
-               lv2_num--;
-           }
-               //
-               // check if proc is not RUNNABLE
-            // if not, deque from lv1
-           else if(lv2[lv2i] -> state != RUNNABLE){
-                dequeue(lv2, lv2_num, lv2i);
-                lv2_num--;
-           }
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        //
-        proc = 0;
-        //search again
-        goto SEARCH;
-    }
-    }
-    while(lv1_num > 0){ 
-    for(int lv1i = 0; lv1i < lv1_num; lv1i++ ){
-        // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
-           proc = lv1[lv1i];
-           switchuvm(lv1[lv1i]);
-           lv1[lv1i]->state = RUNNING;
-           swtch(&cpu->scheduler, proc->context);
-           switchkvm();
-           // kernel regain control
-           //
-           // clear the wait time for proc
-           lv1[lv1i] -> wait_ticks_op[1] = 0;
-           lv1[lv1i] -> wait_ticks[1] = 0;
-           // update wait time for other proc
-           check_promote(lv1[lv1i]);
-           // increment wait by 1 (See check_promote routine)
-           lv1[lv1i] -> wait_ticks_op[1] = 0;
-           lv1[lv1i] -> wait_ticks[1] = 0;
-           // increment ticks
-           (lv1[lv1i] -> ticks_op[1])++;
-           (lv1[lv1i] -> ticks[1])++;
-
-           /*
-           // check if proc is not RUNNABLE
-           // if not, deque from lv1
-           if(lv1[lv1i] -> state != RUNNABLE){
-                dequeue(lv1, lv1_num, lv1i);
-                lv1_num--;
-                proc = 0;
-                goto SEARCH;
-           }
-           */
-           if( (lv1[lv1i] -> ticks_op[1]) >= LV1_TIME){
-               // de-mote proc priority
-               lv1[lv1i] -> priority = 0;
-               lv1[lv1i] -> ticks_op[1] = 0;
-               lv1[lv1i] -> wait_ticks_op[1] = 0;
-               lv1[lv1i] -> wait_ticks[1] = 0;
-               // check if proc is not RUNNABLE
-               // if not, deque from lv2
-               if(lv1[lv1i] -> state != RUNNABLE){
-                   dequeue(lv1, lv1_num, lv1i);
-                   lv1_num--;
-                   proc = 0;
-                   continue;
-               }
-
-               // add the proc to lv0
-               // remove the proc from lv1
-               lv0[lv0_num] = lv1[lv1i];
-               lv0_num++;
-               dequeue(lv1, lv1_num, lv1i);
-               lv1_num--;
-           }
-           // check if proc is not RUNNABLE
-           // if not, deque from lv1
-           else if(lv1[lv1i] -> state != RUNNABLE){
-                dequeue(lv1, lv1_num, lv1i);
-                lv1_num--;
-           }
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        //
-        proc = 0;
-        //search again
-        goto SEARCH;
-    }
+    if((p = pickproc()) == 0){
+      // Nothing to run: zero a page for kalloc_zeroed() while
+      // there are any left to do, and only then halt.
+      if(kzerofill())
+        continue;
+      idle();
+      continue;
     }
 
-    // every time in lv0, start with the first proc (FIFO)
-    while(lv0_num > 0){
-    //for(int lv0i = 0; lv0i < lv0_num; lv0i++){
-           // Switch to chosen process.  It is the process's job
-           // to release ptable.lock and then reacquire it
-           // before jumping back to us.
-           int lv0i = 0;
-           proc = lv0[lv0i];
-           switchuvm(lv0[lv0i]);
-           lv0[lv0i]->state = RUNNING;
-           // while proc is RUNNING, keep scheduling it till it finishes (FIFO)
-           swtch(&cpu->scheduler, proc->context);
-           switchkvm();
-           // kernel regain control
-           // clear the wait time for proc
-           lv0[lv0i] -> wait_ticks_op[0] = 0;
-           lv0[lv0i] -> wait_ticks[0] = 0;
-           // update wait time for other proc
-           check_promote(lv0[lv0i]);
-           // increment wait by 1 (See check_promote routine)
-           lv0[lv0i] -> wait_ticks_op[0] = 0;
-           // increment ticks
-           (lv0[lv0i] -> ticks_op[0])++;
-           (lv0[lv0i] -> ticks[0])++;
-           // check if proc is not RUNNABLE
-           // if not, deque from lv0
-           if(lv0[lv0i] -> state != RUNNABLE){
-                dequeue(lv0, lv0_num, lv0i);
-                lv0_num--;
-                proc = 0;
-                goto SEARCH;
-           }
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        proc = 0;
-        //search again
-        goto SEARCH;
-    }
+    // Switch to chosen process.  It is the process's job
+    // to release ptable.lock and then reacquire it
+    // before jumping back to us.
+    acquire(&ptable.lock);
+    switchuvm(p);
+    do {
+      lv = p->priority;
+      proc = p;
+      p->info->cpu = cpu->id;
+      p->state = RUNNING;
+      swtch(&cpu->scheduler, proc->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      proc = 0;
+      p->qcpu = cpu;
+
+      // clear the wait time for proc
+      p -> wait_ticks[lv] = 0;
+
+      // increment ticks
+      (p -> ticks_op[lv])++;
+      (p -> ticks[lv])++;
+
+      demoted = 0;
+      if(lv > 0 && p -> ticks_op[lv] >= quantum(lv)){
+        // de-mote proc priority
+        p -> priority = lv - 1;
+        p -> ticks_op[lv] = 0;
+        demoted = 1;
+      }
 
+      acquire(&cpu->rqlock);
+      // a process that is not RUNNABLE stays off the queues
+      // until wakeup1() or kill() puts it back
+      if(p -> state == RUNNABLE){
+        if(demoted || lv == NLAYER-1)
+          enqueue(cpu, p);
+        else
+          enqueuehead(cpu, p);
+      }
+      // promote any that waited too long
+      age(cpu);
+      // If p is still the process pickproc() would choose, run it
+      // again now.  ptable.lock is held throughout, so p cannot
+      // have run elsewhere and its page table is still loaded.
+      again = p->state == RUNNABLE &&
+              cpu->runq[bsr(cpu->runqmask)].head == p;
+      if(again)
+        dequeue(cpu, p);
+      release(&cpu->rqlock);
+    } while(again);
+    switchkvm();
     release(&ptable.lock);
-
   }
 }
 
@@ -721,11 +786,35 @@ forkret(void)
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// Hash bucket for sleep channel chan (Fibonacci hashing).
+static struct proc**
+sleepq(void *chan)
+{
+  return &ptable.sleepq[((uint)chan * 2654435761U) >> (32 - SLEEPQSHIFT)];
+}
+
+// Take sleeping process p off its sleep queue.
+// The ptable lock must be held.
+static void
+unsleep(struct proc *p)
+{
+  if(p->sprev)
+    p->sprev->snext = p->snext;
+  else
+    *sleepq(p->chan) = p->snext;
+  if(p->snext)
+    p->snext->sprev = p->sprev;
+  p->snext = 0;
+  p->sprev = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
+  struct proc **q;
+
   if(proc == 0)
     panic("sleep");
 
@@ -746,6 +835,12 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   proc->chan = chan;
   proc->state = SLEEPING;
+  q = sleepq(chan);
+  proc->sprev = 0;
+  proc->snext = *q;
+  if(*q)
+    (*q)->sprev = proc;
+  *q = proc;
   sched();
 
   // Tidy up.
@@ -759,40 +854,21 @@ sleep(void *chan, struct spinlock *lk)
 }
 
 // Wake up all processes sleeping on chan.
+// Only chan's hash bucket is scanned, not the whole table.
 // The ptable lock must be held.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc *p, *next;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan){
-      p->state = RUNNABLE;
-   /*
-      p -> priority = 3;
-      for(int i = 0; i < NLAYER; ++i){
-         p -> ticks[i] = 0;
-        p -> wait_ticks[i] = 0;
-      }
-      */
+  for(p = *sleepq(chan); p; p = next){
+    next = p->snext;
+    if(p->chan == chan){
+      unsleep(p);
       // we add newly arrived proc to its priority level
-      if(p -> priority == 3){
-        lv3[lv3_num] = p;
-        lv3_num++;
-      }
-      else if(p -> priority == 2){
-        lv2[lv2_num] = p;
-        lv2_num++;
-      }
-      else if(p -> priority == 1){
-        lv1[lv1_num] = p;
-        lv1_num++;
-      }
-      else if(p -> priority == 0){
-        lv0[lv0_num] = p;
-        lv0_num++;
-      }
+      setrunnable(p);
     }
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -813,22 +889,13 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.list; p; p = p->pnext){
     if(p->pid == pid){
       p->killed = 1;
       // Wake process from sleep if necessary.
       if(p->state == SLEEPING){
-        p->state = RUNNABLE;
-       /*
-        p -> priority = 3;
-        for(int i = 0; i < NLAYER; ++i){
-            p -> ticks[i] = 0;
-            p -> wait_ticks[i] = 0;
-        }
-        // we add newly arrived proc to q3
-        lv3[lv3_num] = p;
-        lv3_num++;
-        */
+        unsleep(p);
+        setrunnable(p);
       }
       release(&ptable.lock);
       return 0;
@@ -857,9 +924,8 @@ procdump(void)
   char *state;
   uint pc[10];
   
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
+  acquire(&ptable.lock);
+  for(p = ptable.list; p; p = p->pnext){
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
@@ -872,6 +938,7 @@ procdump(void)
     }
     cprintf("\n");
   }
+  release(&ptable.lock);
 }
 
 
@@ -879,26 +946,52 @@ int
 getpinfo(struct pstat* pstat)
 {
     struct proc *p;
-    // Fill in the pstat
+    int i;
+    // Fill in the pstat, each process at its slot
+    memset(pstat, 0, sizeof(*pstat));
     acquire(&ptable.lock); 
-    for(int i = 0; i < NPROC; ++i){
-        p = &ptable.proc[i];
+    for(p = ptable.list; p; p = p -> pnext){
+        i = p -> slot;
         pstat -> pid[i] = p -> pid;
         pstat -> priority[i] = p -> priority;
         pstat -> state[i] = p -> state;
 
-        if(p -> state == UNUSED)
-            pstat -> inuse[i] = 0;
-        else
-            pstat -> inuse[i] = 1;
+        pstat -> inuse[i] = 1;
 
         for(int j = 0; j < 4; ++j){
             pstat -> ticks[i][j] = p -> ticks[j];
             pstat -> wait_ticks[i][j] = p -> wait_ticks[j];
         }
+        // a queued process has also been waiting since enqtick
+        if(p -> state == RUNNABLE)
+            pstat -> wait_ticks[i][p -> priority] += ticks - p -> enqtick;
     }
     
     release(&ptable.lock);
     return 0;
 }
 
+// Report how long each CPU has spent idle, and how often its
+// page cache in kalloc.c was empty.
+int
+getcpustat(struct cpustat *cs)
+{
+  struct cpu *c;
+  uint64 now;
+  int i;
+
+  now = rdtsc();
+  cs->ncpu = ncpu;
+  for(i = 0; i < NCPU; i++){
+    c = &cpus[i];
+    if(i < ncpu && c->tsc0 != 0){
+      cs->idle[i] = c->idlecycles;
+      cs->elapsed[i] = now - c->tsc0;
+    } else {
+      cs->idle[i] = 0;
+      cs->elapsed[i] = 0;
+    }
+  }
+  kallocstat(cs);
+  return 0;
+}
@@ -1,15 +1,27 @@
 #ifndef _PROC_H_
 #define _PROC_H_
 // Segments in proc->gdt.
-// Also known to bootasm.S and trapasm.S
+// Also known to bootasm.S and trapasm.S.
+// sysenter and sysexit need KCODE, KDATA, UCODE and UDATA in
+// that order, one after another.
 #define SEG_KCODE 1  // kernel code
 #define SEG_KDATA 2  // kernel data+stack
-#define SEG_KCPU  3  // kernel per-cpu data
-#define SEG_UCODE 4  // user code
-#define SEG_UDATA 5  // user data+stack
+#define SEG_UCODE 3  // user code
+#define SEG_UDATA 4  // user data+stack
+#define SEG_KCPU  5  // kernel per-cpu data
 #define SEG_TSS   6  // this process's task state
 #define NSEGS     7
 
+#include "spinlock.h"
+#include "timer.h"
+
+// A doubly-linked list of processes, used for the MLFQ run
+// queues and aging lists; see proc.c.
+struct runq {
+  struct proc *head;
+  struct proc *tail;
+};
+
 // Per-CPU state
 struct cpu {
   uchar id;                    // Local APIC ID; index into cpus[] below
@@ -20,6 +32,19 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
 
+  // MLFQ queues of processes waiting to run on this CPU
+  struct spinlock rqlock;      // Protects the fields below
+  struct runq runq[NLAYER];    // Run queue of each priority level
+  struct runq agelist[NLAYER]; // Queued procs of each level, oldest first
+  uint runqmask;               // Bit i set while runq[i] is non-empty
+  int nrunq;                   // Number of queued processes
+
+  volatile uint idle;          // Halted in idle(), wants a wakeup IPI
+  uint64 idlecycles;           // TSC cycles spent halted
+  uint64 tsc0;                 // TSC when the scheduler started
+  volatile uint tickless;      // Clock interrupt stopped while idle
+  int tickalign;               // Clock is one-shot to the next tick
+
   // Cpu-local storage variables; see below
   struct cpu *cpu;
   struct proc *proc;           // The currently-running process.
@@ -64,9 +89,13 @@ struct proc {
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
   char *kstack;                // Bottom of kernel stack for this process
+  struct procinfo *info;       // Read-only to the process at PROCINFO
   enum procstate state;        // Process state
   volatile int pid;            // Process ID
   struct proc *parent;         // Parent process
+  struct proc *pnext;          // Next process in ptable.list
+  struct proc *pprev;          // Previous process in ptable.list
+  int slot;                    // Index in getpinfo()'s pstat
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
@@ -80,7 +109,15 @@ struct proc {
   int ticks[NLAYER]; // num of ticks accumulated at each of 4 priorities
   int wait_ticks[NLAYER]; // num of ticks the proc has waited on each priorities
   int ticks_op[NLAYER]; 
-  int wait_ticks_op[NLAYER];
+  uint enqtick; // tick at which the proc was last queued at its level
+  struct cpu *qcpu;            // CPU whose run queues hold the proc
+  struct proc *qnext;          // Next process in run queue
+  struct proc *qprev;          // Previous process in run queue
+  struct proc *anext;          // Next process in aging list
+  struct proc *aprev;          // Previous process in aging list
+  struct proc *snext;          // Next process in sleep queue
+  struct proc *sprev;          // Previous process in sleep queue
+  struct timer timer;          // Wakeup for sleep() system call
 };
 
 // Process memory is laid out contiguously, low addresses first:
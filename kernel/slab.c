@@ -0,0 +1,180 @@
+// Slab allocator for small kernel objects: files, inodes, pipes
+// and processes.
+//
+// Each kcache hands out objects of one size, carved out of pages
+// from kalloc() called slabs.  A slab starts with a struct slab
+// header, so kcache_free() finds an object's slab by rounding its
+// address down to a page.  Slabs with free objects are kept on the
+// cache's partial list; a slab whose objects are all free again is
+// given back to kalloc().
+//
+// As in kalloc.c, each CPU keeps a magazine of free objects, so most
+// allocations and frees only disable interrupts and touch nothing
+// shared.  An empty magazine is refilled with KCBATCH objects from
+// the slabs, and a full one gives KCBATCH back, under the cache lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "slab.h"
+
+struct obj {
+  struct obj *next;
+};
+
+struct slab {
+  struct kcache *cache;
+  struct slab *next;   // On cache->partial
+  struct slab *prev;
+  struct obj *free;    // Free objects in this slab
+  int inuse;           // Objects allocated (or in a magazine)
+};
+
+#define SLABHDR  ((sizeof(struct slab) + 7) & ~7)
+
+// Set up c to allocate objects of size bytes.
+void
+kcacheinit(struct kcache *c, char *name, uint size)
+{
+  size = (size + 7) & ~7;
+  if(size < sizeof(struct obj) || SLABHDR + size > PGSIZE)
+    panic("kcacheinit");
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->partial = 0;
+  c->nslab = 0;
+  memset(c->mags, 0, sizeof(c->mags));
+}
+
+// Add a fresh slab to the front of c's partial list.
+// Caller must hold c->lock.
+static struct slab*
+grow(struct kcache *c)
+{
+  struct slab *s;
+  struct obj *o;
+  char *p;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->free = 0;
+  s->inuse = 0;
+  for(p = (char*)s + SLABHDR; p + c->size <= (char*)s + PGSIZE; p += c->size){
+    o = (struct obj*)p;
+    o->next = s->free;
+    s->free = o;
+  }
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+  c->nslab++;
+  return s;
+}
+
+// Take s off c's partial list.
+// Caller must hold c->lock.
+static void
+unlink(struct kcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Move up to KCBATCH objects from c's slabs to m.
+static void
+refill(struct kcache *c, struct kcmag *m)
+{
+  struct slab *s;
+  struct obj *o;
+
+  acquire(&c->lock);
+  while(m->n < KCBATCH){
+    if((s = c->partial) == 0 && (s = grow(c)) == 0)
+      break;
+    o = s->free;
+    s->free = o->next;
+    s->inuse++;
+    if(s->free == 0)
+      unlink(c, s);
+    m->obj[m->n++] = o;
+  }
+  release(&c->lock);
+}
+
+// Return KCBATCH objects from m to their slabs.
+static void
+spill(struct kcache *c, struct kcmag *m)
+{
+  struct slab *s;
+  struct obj *o;
+  int i;
+
+  acquire(&c->lock);
+  for(i = 0; i < KCBATCH; i++){
+    o = m->obj[--m->n];
+    s = (struct slab*)PGROUNDDOWN(o);
+    if(s->cache != c)
+      panic("kcache_free");
+    if(s->free == 0){  // was full: back on the partial list
+      s->prev = 0;
+      s->next = c->partial;
+      if(c->partial)
+        c->partial->prev = s;
+      c->partial = s;
+    }
+    o->next = s->free;
+    s->free = o;
+    if(--s->inuse == 0){
+      unlink(c, s);
+      c->nslab--;
+      kfree((char*)s);
+    }
+  }
+  release(&c->lock);
+}
+
+// Allocate a zeroed object from c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kcache_alloc(struct kcache *c)
+{
+  struct kcmag *m;
+  void *v;
+
+  pushcli();
+  m = &c->mags[cpu->id];
+  if(m->n == 0)
+    refill(c, m);
+  v = 0;
+  if(m->n > 0)
+    v = m->obj[--m->n];
+  popcli();
+  if(v)
+    memset(v, 0, c->size);
+  return v;
+}
+
+// Free an object that kcache_alloc(c) returned.
+void
+kcache_free(struct kcache *c, void *v)
+{
+  struct kcmag *m;
+
+  pushcli();
+  m = &c->mags[cpu->id];
+  if(m->n == KCMAGSIZE)
+    spill(c, m);
+  m->obj[m->n++] = v;
+  popcli();
+}
@@ -0,0 +1,24 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+// An object cache: allocates objects of one size (see slab.c).
+// Needs param.h and spinlock.h.
+
+#define KCMAGSIZE  16  // objects a CPU keeps for itself
+#define KCBATCH     8  // objects moved at once to or from the slabs
+
+struct kcmag {
+  int n;                       // Objects in obj[]
+  void *obj[KCMAGSIZE];
+};
+
+struct kcache {
+  struct spinlock lock;        // Protects the slabs
+  char *name;
+  uint size;                   // Object size, rounded up
+  struct slab *partial;        // Slabs with some objects free
+  uint nslab;                  // Slab pages allocated
+  struct kcmag mags[NCPU];     // Each only touched by its own CPU
+};
+
+#endif // _SLAB_H_
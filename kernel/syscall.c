@@ -61,6 +61,8 @@ argptr(int n, char **pp, int size)
     return -1;
   if((uint)i >= proc->sz || (uint)i+size > proc->sz)
     return -1;
+  if(populateuvm(proc->pgdir, i, size, proc->sz) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -105,6 +107,10 @@ static int (*syscalls[])(void) = {
 [SYS_write]   sys_write,
 [SYS_uptime]  sys_uptime,
 [SYS_getpinfo]  sys_getpinfo,
+[SYS_getcpustat]  sys_getcpustat,
+[SYS_nanouptime]  sys_nanouptime,
+[SYS_sync]    sys_sync,
+[SYS_fsync]   sys_fsync,
 };
 
 // Called on a syscall trap. Checks that the syscall number (passed via eax)
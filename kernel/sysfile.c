@@ -106,6 +106,25 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Write all dirty buffers to disk.
+int
+sys_sync(void)
+{
+  bflush(0);
+  return 0;
+}
+
+// Write an open file's dirty blocks to disk.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
@@ -24,5 +24,9 @@ int sys_wait(void);
 int sys_write(void);
 int sys_uptime(void);
 int sys_getpinfo(void);
+int sys_getcpustat(void);
+int sys_nanouptime(void);
+int sys_sync(void);
+int sys_fsync(void);
 
 #endif // _SYSFUNC_H_
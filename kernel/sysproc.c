@@ -71,7 +71,7 @@ sys_sleep(void)
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    timersleep(ticks0 + n);
   }
   release(&tickslock);
   return 0;
@@ -90,6 +90,19 @@ sys_uptime(void)
   return xticks;
 }
 
+// return how many nanoseconds have passed since boot,
+// measured with the calibrated TSC.
+int
+sys_nanouptime(void)
+{
+  uint64 *ns;
+
+  if(argptr(0, (void*)&ns, sizeof(*ns)) < 0)
+    return -1;
+  *ns = nanouptime();
+  return 0;
+}
+
 int
 sys_getpinfo(void)
 {
@@ -98,3 +111,13 @@ sys_getpinfo(void)
       return -1;
   return  getpinfo(pstat);
 }
+
+int
+sys_getcpustat(void)
+{
+  struct cpustat *cs;
+
+  if(argptr(0, (void*)&cs, sizeof(*cs)) < 0)
+    return -1;
+  return getcpustat(cs);
+}
@@ -1,9 +1,17 @@
 // Intel 8253/8254/82C54 Programmable Interval Timer (PIT).
 // Only used on uniprocessors;
 // SMP machines use the local APIC timer.
+//
+// Also the clock interrupt handler, which stops while a CPU is
+// idle, and the timer wheel that wakes processes in the sleep()
+// system call when their deadline arrives.
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "sysinfo.h"
 #include "traps.h"
 #include "x86.h"
 
@@ -16,17 +24,316 @@
 #define TIMER_FREQ      1193182
 #define TIMER_DIV(x)    ((TIMER_FREQ+(x)/2)/(x))
 
+#define TIMER_CNTR2     (IO_TIMER1 + 2) // timer counter 2 port
 #define TIMER_MODE      (IO_TIMER1 + 3) // timer mode port
 #define TIMER_SEL0      0x00    // select counter 0
+#define TIMER_SEL2      0x80    // select counter 2
+#define TIMER_INTTC     0x00    // mode 0, intr on terminal cnt
 #define TIMER_RATEGEN   0x04    // mode 2, rate generator
 #define TIMER_16BIT     0x30    // r/w counter 16 bits, LSB first
 
+#define IO_PPI          0x061   // 8255 port B
+#define PPI_GATE2       0x01    // counter 2 gate
+#define PPI_SPKR        0x02    // speaker data
+#define PPI_OUT2        0x20    // counter 2 output
+
 void
 timerinit(void)
 {
-  // Interrupt 100 times/sec.
+  // Interrupt HZ times/sec.
   outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
-  outb(IO_TIMER1, TIMER_DIV(100) % 256);
-  outb(IO_TIMER1, TIMER_DIV(100) / 256);
+  outb(IO_TIMER1, TIMER_DIV(HZ) % 256);
+  outb(IO_TIMER1, TIMER_DIV(HZ) / 256);
   picenable(IRQ_TIMER);
 }
+
+// Clock calibration.
+//
+// Nothing tells us how fast the TSC and the local APIC timer run,
+// so clockinit() times both against PIT counter 2, whose input
+// clock is TIMER_FREQ on every PC, for CALHZ'th of a second at boot.
+// The TSC then gives nanosecond time: nanouptime() scales cycles
+// since boot by tscmult, the length of a cycle in ns as a 32.32
+// fixed-point number.  The TSCs of all CPUs are assumed to run in
+// step, as they do on anything with an invariant TSC.
+//
+// The scale and ticks are kept in the sysinfo page, which every
+// process can read (see sysinfo.h), so user code can do the same.
+
+#define CALHZ 100
+
+static union {
+  struct sysinfo s;
+  char page[PGSIZE];   // nothing else may share the page
+} sysinfopage __attribute__((aligned(PGSIZE)));
+
+struct sysinfo *sysinfo = &sysinfopage.s;
+
+// n / d.  The kernel is not linked with libgcc, which has the
+// 64-bit division gcc would otherwise call, and this is only
+// needed at boot.
+static uint64
+div64(uint64 n, uint d)
+{
+  uint64 q, r;
+  int i;
+
+  q = r = 0;
+  for(i = 63; i >= 0; i--){
+    r = (r << 1) | ((n >> i) & 1);
+    q <<= 1;
+    if(r >= d){
+      r -= d;
+      q |= 1;
+    }
+  }
+  return q;
+}
+
+// Measure the TSC rate and the local APIC timer's tick length,
+// then start the APIC timer ticking.  Runs on the boot processor,
+// after lapicinit() and before interrupts are enabled.
+void
+clockinit(void)
+{
+  uint count, ns, lapic0, lapic1;
+  uint64 tsc0, tsc1;
+
+  count = TIMER_DIV(CALHZ);
+  ns = count * (1000000000 / TIMER_FREQ) +
+       count * (1000000000 % TIMER_FREQ) / TIMER_FREQ;
+
+  // Counter 2 raises its output when it has counted down to 0.
+  outb(IO_PPI, (inb(IO_PPI) & ~PPI_SPKR) | PPI_GATE2);
+  outb(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+  lapiconeshot(0xffffffff);
+  lapic0 = lapiccount();
+  tsc0 = rdtsc();
+  outb(TIMER_CNTR2, count % 256);
+  outb(TIMER_CNTR2, count / 256);
+  while((inb(IO_PPI) & PPI_OUT2) == 0)
+    ;
+  tsc1 = rdtsc();
+  lapic1 = lapiccount();
+
+  sysinfo->hz = HZ;
+  sysinfo->tscmult = div64((uint64)ns << 32, tsc1 - tsc0);
+  sysinfo->tscboot = tsc1;
+  if(lapic){
+    lapicticr = div64((uint64)(lapic0 - lapic1) * (1000000000/HZ), ns);
+    lapicperiodic();
+  }
+  cprintf("clock: tsc %d kHz, lapic timer %d counts/tick\n",
+          (uint)div64((tsc1 - tsc0) * 1000000, ns), lapicticr);
+}
+
+// Nanoseconds since boot.
+uint64
+nanouptime(void)
+{
+  return tscns(rdtsc() - sysinfo->tscboot, sysinfo->tscmult);
+}
+
+// Timer wheel.
+//
+// A pending timer sits in slot expire % NWHEEL, so each tick only
+// has to look at one slot rather than waking every sleeper to
+// recheck its own deadline.  Timers more than NWHEEL ticks away
+// share a slot with nearer ones and are skipped until the wheel
+// comes round to them.  The wheel is protected by tickslock.
+
+#define NWHEEL 256
+
+static struct timer *wheel[NWHEEL];
+
+static void
+timerdel(struct timer *t)
+{
+  if(t->prev)
+    t->prev->next = t->next;
+  else
+    wheel[t->expire % NWHEEL] = t->next;
+  if(t->next)
+    t->next->prev = t->prev;
+  t->next = 0;
+  t->prev = 0;
+  t->pending = 0;
+}
+
+// Sleep until ticks reaches deadline, or the process is killed.
+// Caller must hold tickslock, and deadline must be in the future.
+void
+timersleep(uint deadline)
+{
+  struct timer *t, **slot;
+
+  t = &proc->timer;
+  t->expire = deadline;
+  slot = &wheel[deadline % NWHEEL];
+  t->prev = 0;
+  t->next = *slot;
+  if(*slot)
+    (*slot)->prev = t;
+  *slot = t;
+  t->pending = 1;
+
+  sleep(t, &tickslock);
+
+  // kill() wakes sleepers early; take the timer back off the wheel.
+  if(t->pending)
+    timerdel(t);
+}
+
+// Fire the timers that expire at the current tick.
+static void
+timertick(void)
+{
+  struct timer *t, *next;
+
+  for(t = wheel[ticks % NWHEEL]; t; t = next){
+    next = t->next;
+    if(t->expire == ticks){
+      timerdel(t);
+      wakeup(t);
+    }
+  }
+}
+
+// Advance ticks by one.  Caller must hold tickslock.
+static void
+tick(void)
+{
+  ticks++;
+  sysinfo->ticks = ticks;
+  timertick();
+}
+
+// Number of ticks from now until the first pending timer expires,
+// or NWHEEL if none expires sooner.  Caller must hold tickslock.
+static uint
+timernext(void)
+{
+  struct timer *t;
+  uint d;
+
+  for(d = 1; d < NWHEEL; d++)
+    for(t = wheel[(ticks + d) % NWHEEL]; t; t = t->next)
+      if(t->expire == ticks + d)
+        return d;
+  return NWHEEL;
+}
+
+// Tickless idle.
+//
+// An idle CPU has no use for the clock interrupt, so idle() calls
+// timeridle() to stop it before halting and timerbusy() to restart
+// it after.  CPU 0 also keeps ticks and the timer wheel, so it only
+// stops ticking while every other CPU is idle as well (so nobody
+// sees ticks go stale), and then arms a one-shot interrupt for the
+// first timer deadline instead.  The one-shot lands on the same
+// tick boundary the periodic timer would have, and timerbusy()
+// adds up the whole ticks that went by and arms another one-shot
+// for the rest of the current tick, so ticks loses no time.
+// Without a local APIC (uniprocessor PIT) the clock just runs.
+
+// Only CPU 0 sets or uses these.
+static uint idlecount;  // Counts cpu 0's one-shot was armed with
+static uint idleleft;   // Counts that were left in the current tick
+
+// Clock interrupt.
+void
+timerintr(void)
+{
+  // An idle CPU 0 catches up on ticks in timerbusy().
+  if(cpu->tickless)
+    return;
+  if(cpu->tickalign){
+    cpu->tickalign = 0;
+    lapicperiodic();
+  }
+  if(cpu->id == 0){
+    acquire(&tickslock);
+    tick();
+    release(&tickslock);
+  }
+}
+
+// Stop this CPU's clock interrupt before it halts.
+// Interrupts must be disabled.
+void
+timeridle(void)
+{
+  struct cpu *c;
+  uint left, n;
+
+  if(!lapic)
+    return;
+  // A tick that is already due must be counted by timerintr().
+  left = lapiccount();
+  if(left == 0 || lapicpending(T_IRQ0 + IRQ_TIMER))
+    return;
+  if(cpu->id != 0){
+    xchg(&cpu->tickless, 1);
+    lapiconeshot(0);
+    return;
+  }
+
+  // Publish before looking at the others; a CPU leaving idle
+  // clears its own flag before it looks at ours (timerbusy).
+  xchg(&cpu->tickless, 1);
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c != cpu && !c->tickless){
+      cpu->tickless = 0;
+      return;
+    }
+  }
+
+  acquire(&tickslock);
+  n = timernext();
+  release(&tickslock);
+  if(n - 1 > (0xffffffff - left) / lapicticr)
+    n = 1 + (0xffffffff - left) / lapicticr;
+  idleleft = left;
+  idlecount = idleleft + (n - 1) * lapicticr;
+  lapiconeshot(idlecount);
+  cpu->tickalign = 0;
+}
+
+// Restart this CPU's clock interrupt after it wakes from idle.
+// Interrupts must be disabled.
+void
+timerbusy(void)
+{
+  uint elapsed, n, rest;
+
+  if(!cpu->tickless)
+    return;
+  xchg(&cpu->tickless, 0);
+  if(cpu->id != 0){
+    lapicperiodic();
+    // CPU 0 may have stopped ticking because we were idle.
+    if(cpus[0].tickless)
+      lapicipi(cpus[0].id, T_IRQ0 + IRQ_WAKEUP);
+    return;
+  }
+
+  elapsed = idlecount - lapiccount();
+  if(elapsed < idleleft){
+    n = 0;
+    rest = idleleft - elapsed;
+  } else {
+    n = 1 + (elapsed - idleleft) / lapicticr;
+    rest = lapicticr - (elapsed - idleleft) % lapicticr;
+  }
+  acquire(&tickslock);
+  while(n-- > 0)
+    tick();
+  release(&tickslock);
+
+  if(rest == lapicticr)
+    lapicperiodic();
+  else {
+    lapiconeshot(rest);
+    cpu->tickalign = 1;
+  }
+}
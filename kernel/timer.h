@@ -0,0 +1,12 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+// A pending wakeup on the timer wheel (see timer.c).
+struct timer {
+  uint expire;          // Value of ticks at which to fire
+  struct timer *next;   // Next timer in the same wheel slot
+  struct timer *prev;   // Previous timer in the same wheel slot
+  int pending;          // On the wheel, not yet fired
+};
+
+#endif // _TIMER_H_
@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "sysinfo.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -31,6 +32,28 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// Point this CPU's sysenter instruction at sysentry in trapasm.S,
+// if it has one, and tell usys.S to use it instead of int.
+// switchuvm() keeps the sysenter stack pointing at the kernel stack
+// of the running process.
+void
+sysenterinit(void)
+{
+  extern char sysentry[];
+  uint eax, edx;
+
+  cpuid(1, &eax, 0, 0, &edx);
+  if(!(edx & CPUID_SEP))
+    return;
+  // The Pentium Pro claims sysenter but does not have it.
+  if(((eax >> 8) & 0xf) == 6 && ((eax >> 4) & 0xf) < 3 && (eax & 0xf) < 3)
+    return;
+  wrmsr(MSR_SYSENTER_CS, SEG_KCODE << 3);
+  wrmsr(MSR_SYSENTER_EIP, (uint)sysentry);
+  wrmsr(MSR_SYSENTER_ESP, 0);
+  sysinfo->sysenter = 1;
+}
+
 void
 trap(struct trapframe *tf)
 {
@@ -46,12 +69,7 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
-    if(cpu->id == 0){
-      acquire(&tickslock);
-      ticks++;
-      wakeup(&ticks);
-      release(&tickslock);
-    }
+    timerintr();
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -69,13 +87,23 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKEUP:
+    // Nothing to do: the interrupt itself ends the hlt in idle().
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
             cpu->id, tf->cs, tf->eip);
     lapiceoi();
     break;
-   
+  case T_PGFLT:
+    // A first touch of memory sbrk() reserved, or a write to a
+    // page fork() shared copy-on-write, by the process or by the
+    // kernel on its behalf.  Any other fault is an error.
+    if(proc && pagefault(proc->pgdir, rcr2(), proc->sz) == 0)
+      break;
+    // fall through
   default:
     if(proc == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
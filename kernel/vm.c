@@ -5,18 +5,12 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "sysinfo.h"
 
 extern char data[];  // defined in data.S
 
 static pde_t *kpgdir;  // for use in scheduler()
-
-// Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
-void
-kvmalloc(void)
-{
-  kpgdir = setupkvm();
-}
+static int pse;        // CPU has 4MB pages
 
 // Set up CPU's kernel segment descriptors.
 // Run once at boot time on each CPU.
@@ -59,10 +53,9 @@ walkpgdir(pde_t *pgdir, const void *va, int create)
   if(*pde & PTE_P){
     pgtab = (pte_t*)PTE_ADDR(*pde);
   } else {
-    if(!create || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!create || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table 
     // entries, if necessary.
@@ -107,56 +100,139 @@ mappages(pde_t *pgdir, void *la, uint size, uint pa, int perm)
 // 
 // setupkvm() and exec() set up every page table like this:
 //   0..640K          : user memory (text, data, stack, heap)
-//   640K..1M         : mapped direct (for IO space)
+//   640K..648K       : sysinfo and procinfo pages, user read-only
+//   648K..1M         : mapped direct (for IO space)
 //   1M..end          : mapped direct (for the kernel's text and data)
-//   end..PHYSTOP     : mapped direct (kernel heap and user pages)
+//   end..phystop     : mapped direct (kernel heap and user pages)
 //   0xfe000000..0    : mapped direct (devices such as ioapic)
 //
 // The kernel allocates memory for its heap and for user memory
-// between kernend and the end of physical memory (PHYSTOP).
+// between kernend and the end of physical memory (phystop, which
+// kinit finds at boot).
 // The virtual address space of each user program includes the kernel
 // (which is inaccessible in user mode).  The user program addresses
 // range from 0 till 640KB (USERTOP), which where the I/O hole starts
 // (both in physical memory and in the kernel's virtual address
-// space).
+// space).  The first two pages of the hole, VGA graphics memory
+// that xv6 does not use, hold the info pages instead (sysinfo.h).
 static struct kmap {
   void *p;
   void *e;
   int perm;
 } kmap[] = {
-  {(void*)USERTOP,    (void*)0x100000, PTE_W},  // I/O space
+  {(void*)PROCINFO+PGSIZE, (void*)0x100000, PTE_W},  // I/O space
   {(void*)0x100000,   data,            0    },  // kernel text, rodata
-  {data,              (void*)PHYSTOP,  PTE_W},  // kernel data, memory
+  {data,              0,               PTE_W},  // kernel data, memory (phystop)
   {(void*)0xFE000000, 0,               PTE_W},  // device mappings
 };
 
+// Map the direct-mapped kernel range k into pgdir.  Each aligned
+// 4MB piece gets a single 4MB page if the CPU has them; the rest
+// (in practice the first 4MB, which also holds the read-only
+// kernel text and user memory) gets 4KB pages.
+static int
+kmappages(pde_t *pgdir, struct kmap *k, int perm)
+{
+  uint a, n, m;
+
+  a = (uint)k->p;
+  n = (uint)k->e - a;
+  while(n > 0){
+    if(pse && a % PTSIZE == 0 && n >= PTSIZE){
+      if(pgdir[PDX(a)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(a)] = a | perm | PTE_PS | PTE_P;
+      m = PTSIZE;
+    } else {
+      m = PTSIZE - a % PTSIZE;
+      if(m > n)
+        m = n;
+      if(mappages(pgdir, (void*)a, m, a, perm) < 0)
+        return -1;
+    }
+    a += m;
+    n -= m;
+  }
+  return 0;
+}
+
+// Allocate one page table for the machine for the kernel address
+// space for scheduler processes.
+// Its page tables also serve as the kernel half of every other
+// page table (see setupkvm).  The kernel mappings are the same in
+// every address space, so they are global: switching page tables
+// leaves their TLB entries alone (see vmenable).
+void
+kvmalloc(void)
+{
+  struct kmap *k;
+  uint edx;
+
+  cpuid(1, 0, 0, 0, &edx);
+  pse = (edx & CPUID_PSE) != 0;
+  kmap[2].e = (void*)phystop;
+  if((kpgdir = (pde_t*)kalloc_zeroed()) == 0)
+    panic("kvmalloc");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(kmappages(kpgdir, k, k->perm|PTE_G) < 0)
+      panic("kvmalloc: mappages");
+  if(mappages(kpgdir, (void*)SYSINFO, PGSIZE, PADDR(sysinfo), PTE_U|PTE_G) < 0)
+    panic("kvmalloc: sysinfo");
+}
+
 // Set up kernel part of a page table.
+// The kernel's page tables, built once by kvmalloc, are shared
+// by reference.  The first one also maps user memory, so each
+// page table gets a private copy of it.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
+  pte_t *pgtab;
+  uint i;
 
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  k = kmap;
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->p, k->e - k->p, (uint)k->p, k->perm) < 0)
+  memmove(pgdir, kpgdir, PGSIZE);
+  for(i = 0; i <= PDX(PROCINFO); i++){
+    if((pgtab = (pte_t*)kalloc()) == 0){
+      while(i-- > 0)
+        kfree((char*)PTE_ADDR(pgdir[i]));
+      kfree((char*)pgdir);
       return 0;
-
+    }
+    memmove(pgtab, (char*)PTE_ADDR(kpgdir[i]), PGSIZE);
+    pgdir[i] = PADDR(pgtab) | PTE_FLAGS(kpgdir[i]);
+  }
   return pgdir;
 }
 
+// Map a process's procinfo page, read-only, into its page table.
+int
+mapprocinfo(pde_t *pgdir, struct procinfo *pi)
+{
+  return mappages(pgdir, (void*)PROCINFO, PGSIZE, PADDR(pi), PTE_U);
+}
+
 // Turn on paging.
 void
 vmenable(void)
 {
-  uint cr0;
+  uint cr0, edx;
+
+  // Honor PTE_G if the CPU has global pages, and PTE_PS
+  // in kpgdir's 4MB pages (see kmappages).
+  cpuid(1, 0, 0, 0, &edx);
+  if(edx & CPUID_PGE)
+    lcr4(rcr4() | CR4_PGE);
+  if(pse)
+    lcr4(rcr4() | CR4_PSE);
 
   switchkvm(); // load kpgdir into cr3
   cr0 = rcr0();
-  cr0 |= CR0_PG;
+  // WP makes the kernel fault on read-only user pages too, so
+  // that its writes to copy-on-write pages get copied (pagefault).
+  cr0 |= CR0_PG | CR0_WP;
   lcr0(cr0);
 }
 
@@ -176,8 +252,10 @@ switchuvm(struct proc *p)
   cpu->gdt[SEG_TSS] = SEG16(STS_T32A, &cpu->ts, sizeof(cpu->ts)-1, 0);
   cpu->gdt[SEG_TSS].s = 0;
   cpu->ts.ss0 = SEG_KDATA << 3;
-  cpu->ts.esp0 = (uint)proc->kstack + KSTACKSIZE;
+  cpu->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
   ltr(SEG_TSS << 3);
+  if(sysinfo->sysenter)
+    wrmsr(MSR_SYSENTER_ESP, cpu->ts.esp0);
   if(p->pgdir == 0)
     panic("switchuvm: no pgdir");
   lcr3(PADDR(p->pgdir));  // switch to new address space
@@ -193,8 +271,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
   
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, PADDR(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -238,13 +315,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     mappages(pgdir, (char*)a, PGSIZE, PADDR(mem), PTE_W|PTE_U);
   }
   return newsz;
@@ -254,6 +330,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
+// If pgdir is loaded, the freed pages' TLB entries are dropped.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
@@ -270,8 +347,10 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      kfree((char*)pa);
       *pte = 0;
+      if(rcr3() == PADDR(pgdir))
+        invlpg((void*)a);
+      kfree((char*)pa);
     }
   }
   return newsz;
@@ -288,40 +367,103 @@ freevm(pde_t *pgdir)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, USERTOP, 0);
   for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P)
+    if((pgdir[i] & PTE_P) && pgdir[i] != kpgdir[i])  // not shared
       kfree((char*)PTE_ADDR(pgdir[i]));
   }
   kfree((char*)pgdir);
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  The two share every page copy-on-write:
+// writable pages become read-only in both, marked PTE_COW, and
+// the first write to one gets the writer its own copy (pagefault).
+// pgdir must be the current page table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    // Pages sbrk() reserved but nobody has touched yet stay
+    // unallocated in the child too.
+    if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, PADDR(mem), PTE_W|PTE_U) < 0)
+    if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
       goto bad;
+    kref((char*)pa);
   }
+  lcr3(rcr3());  // flush the parent's writable TLB entries
   return d;
 
 bad:
   freevm(d);
+  lcr3(rcr3());
+  return 0;
+}
+
+// Handle a page fault at user virtual address va in pgdir, the
+// current page table of a process of size sz:
+//  - a page that sbrk() reserved but has not allocated gets a
+//    freshly zeroed page;
+//  - a write to a copy-on-write page gets the process a writable
+//    page of its own: the shared one if nobody else uses it any
+//    more, else a copy.
+// Returns -1 if the fault is an error or memory runs out.
+int
+pagefault(pde_t *pgdir, uint va, uint sz)
+{
+  pte_t *pte;
+  uint pa;
+  char *mem;
+
+  if(va >= sz)
+    return -1;
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if(pte == 0 || !(*pte & PTE_P)){
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    if(mappages(pgdir, (void*)va, PGSIZE, PADDR(mem), PTE_W|PTE_U) < 0){
+      kfree(mem);
+      return -1;
+    }
+    return 0;
+  }
+  if((*pte & (PTE_U|PTE_COW)) != (PTE_U|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  if(krefs((char*)pa) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PADDR(mem) | PTE_FLAGS(*pte);
+    kfree((char*)pa);
+  }
+  *pte = (*pte & ~PTE_COW) | PTE_W;
+  invlpg((void*)va);
+  return 0;
+}
+
+// Allocate the pages of [va, va+n) that sbrk() reserved but that
+// have not been touched, so that the kernel does not run out of
+// memory part way through using them.  Returns -1 if it would.
+int
+populateuvm(pde_t *pgdir, uint va, uint n, uint sz)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = (uint)PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(pgdir, (void*)a, 0);
+    if((pte == 0 || !(*pte & PTE_P)) && pagefault(pgdir, a, sz) < 0)
+      return -1;
+  }
   return 0;
 }
 
@@ -332,7 +474,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -0,0 +1,41 @@
+// Print how busy each CPU has been and how often its page cache
+// in the kernel's page allocator satisfied kalloc(), then the
+// free blocks of each size in the buddy allocator.
+//
+// usage: cpustat
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "pstat.h"
+
+int stdout = 1;
+
+int
+main(int argc, char *argv[])
+{
+  struct cpustat cs;
+  uint idle, elapsed, npages;
+  int i;
+
+  if(getcpustat(&cs) < 0){
+    printf(stdout, "cpustat: getcpustat failed\n");
+    exit();
+  }
+  for(i = 0; i < cs.ncpu; i++){
+    // Scaled down so the percentage fits in 32-bit arithmetic.
+    idle = cs.idle[i] >> 16;
+    elapsed = cs.elapsed[i] >> 16;
+    printf(stdout, "cpu%d: idle %d%%, kalloc hits %d misses %d\n", i,
+           elapsed >= 100 ? idle / (elapsed / 100) : 0,
+           cs.kallochits[i], cs.kallocmisses[i]);
+  }
+  npages = 0;
+  printf(stdout, "free blocks:");
+  for(i = 0; i <= KMAXORDER; i++){
+    printf(stdout, " %d", cs.freeblocks[i]);
+    npages += cs.freeblocks[i] << i;
+  }
+  printf(stdout, " (of 1 to %d pages), %d pages free\n", 1 << KMAXORDER, npages);
+  exit();
+}
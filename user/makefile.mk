@@ -2,6 +2,7 @@
 # user programs
 USER_PROGS := \
 	cat\
+	cpustat\
 	echo\
 	forktest\
 	grep\
@@ -11,8 +12,11 @@ USER_PROGS := \
 	ls\
 	mkdir\
 	rm\
+	schedbench\
 	sh\
+	sleepbench\
 	stressfs\
+	syscallbench\
 	tester\
 	usertests\
 	wc\
@@ -0,0 +1,70 @@
+// Measure how scheduler throughput scales with the number of CPUs.
+// Forks a fixed number of CPU-bound workers, each doing the same
+// amount of work, and reports how many ticks they took in total.
+// Run it under "make qemu CPUS=1" through "make qemu CPUS=8" and
+// compare the work/100 ticks figures.
+//
+// usage: schedbench [nworkers [units]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NWORKER  8
+#define UNITS    20
+#define SPIN     1000000
+
+int stdout = 1;
+
+// One unit of pure CPU work.
+void
+spin(void)
+{
+  volatile int i, x;
+
+  x = 0;
+  for(i = 0; i < SPIN; i++)
+    x += i;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nworker, units, i, j, pid, start, elapsed;
+
+  nworker = NWORKER;
+  units = UNITS;
+  if(argc > 1)
+    nworker = atoi(argv[1]);
+  if(argc > 2)
+    units = atoi(argv[2]);
+  if(nworker < 1 || units < 1){
+    printf(stdout, "usage: schedbench [nworkers [units]]\n");
+    exit();
+  }
+
+  printf(stdout, "schedbench: %d workers x %d units\n", nworker, units);
+  start = uptime();
+  for(i = 0; i < nworker; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(stdout, "schedbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      for(j = 0; j < units; j++)
+        spin();
+      exit();
+    }
+  }
+  nworker = i;
+  for(i = 0; i < nworker; i++)
+    wait();
+  elapsed = uptime() - start;
+  if(elapsed < 1)
+    elapsed = 1;
+
+  printf(stdout, "schedbench: %d units in %d ticks, %d units/100 ticks\n",
+         nworker * units, elapsed, nworker * units * 100 / elapsed);
+  exit();
+}
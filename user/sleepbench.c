@@ -0,0 +1,86 @@
+// Measure how much sleeping processes cost the processes that
+// are running.  A CPU-bound loop counts how many iterations it
+// completes in a fixed number of ticks, first alone and then while
+// many other processes sit in long sleep() calls.  With sleepers
+// woken only at their deadline the two counts should be close.
+//
+// usage: sleepbench [nsleepers [ticks]]
+//
+// Every sleeper is a process, so NPROC caps nsleepers; MAXSLEEPER
+// leaves room for init, sh and sleepbench itself.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+#define MAXSLEEPER (NPROC - 8)
+#define NSLEEPER   MAXSLEEPER
+#define TICKS      300
+
+int stdout = 1;
+
+// Spin for the given number of ticks; return iterations done.
+int
+work(int n)
+{
+  volatile int i;
+  int count, start;
+
+  count = 0;
+  start = uptime();
+  while(uptime() - start < n){
+    for(i = 0; i < 10000; i++)
+      ;
+    count++;
+  }
+  return count;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nsleeper, n, i, alone, loaded, pid;
+  int pids[MAXSLEEPER];
+
+  nsleeper = NSLEEPER;
+  n = TICKS;
+  if(argc > 1)
+    nsleeper = atoi(argv[1]);
+  if(argc > 2)
+    n = atoi(argv[2]);
+  if(nsleeper < 0 || nsleeper > MAXSLEEPER || n < 1){
+    printf(stdout, "usage: sleepbench [nsleepers (at most %d) [ticks]]\n",
+           MAXSLEEPER);
+    exit();
+  }
+
+  printf(stdout, "sleepbench: %d sleepers, %d ticks\n", nsleeper, n);
+  alone = work(n);
+
+  for(i = 0; i < nsleeper; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(stdout, "sleepbench: fork failed after %d sleepers\n", i);
+      break;
+    }
+    if(pid == 0){
+      sleep(100 * n);
+      exit();
+    }
+    pids[i] = pid;
+  }
+  nsleeper = i;
+  loaded = work(n);
+
+  for(i = 0; i < nsleeper; i++)
+    kill(pids[i]);
+  for(i = 0; i < nsleeper; i++)
+    wait();
+
+  if(alone < 1)
+    alone = 1;
+  printf(stdout, "sleepbench: alone %d, with %d sleepers %d (%d%%)\n",
+         alone, nsleeper, loaded, loaded * 100 / alone);
+  exit();
+}
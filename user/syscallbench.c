@@ -0,0 +1,74 @@
+// Measure system call latency through the int $T_SYSCALL path and
+// the sysenter path, by timing a null system call (getpid) made
+// each way in a loop.
+//
+// usage: syscallbench
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "syscall.h"
+#include "traps.h"
+#include "sysinfo.h"
+
+#define LOGCALLS 16           // time 1<<LOGCALLS calls each way
+
+int stdout = 1;
+
+int
+intcall(int num)
+{
+  int r;
+
+  asm volatile("int %1" : "=a" (r) : "i" (T_SYSCALL), "a" (num)
+                        : "memory");
+  return r;
+}
+
+int
+sysentercall(int num)
+{
+  int r;
+
+  asm volatile("movl %%esp, %%ecx\n\t"
+               "movl $1f, %%edx\n\t"
+               "sysenter\n"
+               "1:"
+               : "=a" (r) : "a" (num) : "ecx", "edx", "memory");
+  return r;
+}
+
+// Return the mean time of a call to f, in nanoseconds.
+uint
+bench(int (*f)(int))
+{
+  uint64 t0, t1;
+  int i;
+
+  nanouptime(&t0);
+  for(i = 0; i < (1 << LOGCALLS); i++)
+    f(SYS_getpid);
+  nanouptime(&t1);
+  return (t1 - t0) >> LOGCALLS;
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(intcall(SYS_getpid) != getpid()){
+    printf(stdout, "syscallbench: int getpid failed\n");
+    exit();
+  }
+  printf(stdout, "int $%d: %d ns/call\n", T_SYSCALL, bench(intcall));
+
+  if(!((struct sysinfo*)SYSINFO)->sysenter){
+    printf(stdout, "sysenter: not supported\n");
+    exit();
+  }
+  if(sysentercall(SYS_getpid) != getpid()){
+    printf(stdout, "syscallbench: sysenter getpid failed\n");
+    exit();
+  }
+  printf(stdout, "sysenter: %d ns/call\n", bench(sysentercall));
+  exit();
+}
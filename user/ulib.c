@@ -3,6 +3,7 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "sysinfo.h"
 
 char*
 strcpy(char *s, char *t)
@@ -103,3 +104,39 @@ memmove(void *vdst, void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// The clock, pid and cpu are read straight from the info pages
+// the kernel maps into every process (sysinfo.h), rather than
+// with a system call.
+
+int
+getpid(void)
+{
+  return ((struct procinfo*)PROCINFO)->pid;
+}
+
+// Return the CPU this process is running on, which may have
+// changed by the time the caller looks at it.
+int
+getcpu(void)
+{
+  return ((struct procinfo*)PROCINFO)->cpu;
+}
+
+// Return how many clock ticks have occurred since boot.
+int
+uptime(void)
+{
+  return ((struct sysinfo*)SYSINFO)->ticks;
+}
+
+// Store the number of nanoseconds since boot in *ns.
+int
+nanouptime(uint64 *ns)
+{
+  struct sysinfo *si;
+
+  si = (struct sysinfo*)SYSINFO;
+  *ns = tscns(rdtsc() - si->tscboot, si->tscmult);
+  return 0;
+}
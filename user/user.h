@@ -3,6 +3,7 @@
 
 struct stat;
 struct pstat;
+struct cpustat;
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // system calls
@@ -23,10 +24,10 @@ int link(char*, char*);
 int mkdir(char*);
 int chdir(char*);
 int dup(int);
-int getpid(void);
 char* sbrk(int);
 int sleep(int);
-int uptime(void);
+int sync(void);
+int fsync(int);
 
 // user library functions (ulib.c)
 int stat(char*, struct stat*);
@@ -42,6 +43,11 @@ void* malloc(uint);
 void free(void*);
 int atoi(const char*);
 int getpinfo(struct pstat*);
+int getcpustat(struct cpustat*);
+int getpid(void);
+int getcpu(void);
+int uptime(void);
+int nanouptime(uint64*);
 
 #endif // _USER_H_
 
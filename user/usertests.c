@@ -1,10 +1,12 @@
 #include "types.h"
+#include "param.h"
 #include "stat.h"
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
 #include "syscall.h"
 #include "traps.h"
+#include "sysinfo.h"
 
 #define PAGE (4096)
 #define MAX_PROC_MEM (640 * 1024)
@@ -1173,7 +1175,7 @@ iref(void)
 
   printf(1, "empty file name\n");
 
-  // the 50 is NINODE
+  // the 50 was NINODE, the size of the old fixed inode table
   for(i = 0; i < 50 + 1; i++){
     if(mkdir("irefd") != 0){
       printf(1, "mkdir irefd failed\n");
@@ -1324,8 +1326,9 @@ sbrktest(void)
     exit();
   }
 
-  // can we read the kernel's memory?
-  for(a = (char*)(640*1024); a < (char*)2000000; a += 50000){
+  // can we read the kernel's memory?  (the info pages just
+  // above 640K are meant to be readable)
+  for(a = (char*)(PROCINFO + PAGE); a < (char*)2000000; a += 50000){
     ppid = getpid();
     pid = fork();
     if(pid < 0){
@@ -1437,6 +1440,215 @@ validatetest(void)
   printf(stdout, "validate ok\n");
 }
 
+// does nanouptime() run forwards, and at the same rate as ticks?
+void
+clocktest(void)
+{
+  uint64 t0, t1, min;
+  int i;
+
+  printf(stdout, "clock test\n");
+  if(nanouptime(&t0) < 0){
+    printf(stdout, "nanouptime failed\n");
+    exit();
+  }
+  for(i = 0; i < 1000; i++){
+    nanouptime(&t1);
+    if(t1 < t0){
+      printf(stdout, "clock went backwards\n");
+      exit();
+    }
+    t0 = t1;
+  }
+  // sleep(10) may start just before a tick, so it can be as
+  // short as 9 whole ticks.
+  sleep(10);
+  nanouptime(&t1);
+  min = 9 * (1000000000 / HZ);
+  if(t1 - t0 < min || t1 - t0 > 100 * min){
+    printf(stdout, "clock test failed: sleep(10) did not take 10 ticks\n");
+    exit();
+  }
+  printf(stdout, "clock test ok\n");
+}
+
+// do parent and child get separate copies of memory
+// that fork() shares copy-on-write, including memory
+// written by the kernel (read) rather than by the process?
+char cowbuf[3*PAGE];
+void
+cowtest(void)
+{
+  int pid, fds[2], i;
+
+  printf(stdout, "cow test\n");
+  for(i = 0; i < sizeof(cowbuf); i++)
+    cowbuf[i] = 'p';
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    cowbuf[0] = 'c';
+    if(read(fds[0], cowbuf + PAGE, 1) != 1 || cowbuf[PAGE] != 'x'){
+      printf(stdout, "cow test: read into shared page failed\n");
+      exit();
+    }
+    if(cowbuf[2*PAGE] != 'p'){
+      printf(stdout, "cow test: child lost parent's data\n");
+      exit();
+    }
+    exit();
+  } else if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  write(fds[1], "x", 1);
+  wait();
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 0; i < sizeof(cowbuf); i++){
+    if(cowbuf[i] != 'p'){
+      printf(stdout, "cow test failed: child's write seen by parent\n");
+      exit();
+    }
+  }
+  printf(stdout, "cow test ok\n");
+}
+
+// is memory from sbrk() zero when first touched, by the
+// process, by a forked child, or by the kernel in read()?
+void
+lazytest(void)
+{
+  char *a;
+  int fds[2], pid, i;
+
+  printf(stdout, "lazy sbrk test\n");
+  a = sbrk(16*PAGE);
+  if(a == (char*)0xffffffff){
+    printf(stdout, "sbrk failed\n");
+    exit();
+  }
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  write(fds[1], "xy", 2);
+  if(read(fds[0], a + 8*PAGE - 1, 2) != 2 ||
+     a[8*PAGE - 1] != 'x' || a[8*PAGE] != 'y'){
+    printf(stdout, "lazy sbrk test: read() into new memory failed\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  pid = fork();
+  if(pid == 0){
+    for(i = 0; i < 16*PAGE; i += PAGE/2){
+      if(a[i] != 0 && i != 8*PAGE){
+        printf(stdout, "lazy sbrk test: memory not zero\n");
+        exit();
+      }
+    }
+    exit();
+  } else if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  wait();
+  sbrk(-16*PAGE);
+  printf(stdout, "lazy sbrk test ok\n");
+}
+
+// fsync and sync: writes stay readable and files
+// can be synced; pipes cannot.
+void
+synctest(void)
+{
+  char buf[512];
+  int fd, fds[2], i;
+
+  printf(stdout, "sync test\n");
+  fd = open("syncfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "sync test: create failed\n");
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    memset(buf, 'a' + i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(stdout, "sync test: write failed\n");
+      exit();
+    }
+  }
+  if(fsync(fd) != 0){
+    printf(stdout, "sync test: fsync failed\n");
+    exit();
+  }
+  close(fd);
+  if(sync() != 0){
+    printf(stdout, "sync test: sync failed\n");
+    exit();
+  }
+  fd = open("syncfile", 0);
+  for(i = 0; i < 20; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf) ||
+       buf[0] != 'a' + i || buf[511] != 'a' + i){
+      printf(stdout, "sync test: read back wrong data\n");
+      exit();
+    }
+  }
+  close(fd);
+  unlink("syncfile");
+
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  if(fsync(fds[0]) != -1){
+    printf(stdout, "sync test: fsync of a pipe succeeded\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(stdout, "sync test ok\n");
+}
+
+// does the child's info page hold its own pid, and is it
+// read-only?
+void
+infotest(void)
+{
+  int pid, fds[2], cpid;
+
+  printf(stdout, "info page test\n");
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    cpid = getpid();
+    write(fds[1], &cpid, sizeof(cpid));
+    // writing the page must fault and kill us
+    *(int*)PROCINFO = 0;
+    printf(stdout, "info page is writable\n");
+    exit();
+  } else if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(read(fds[0], &cpid, sizeof(cpid)) != sizeof(cpid) || cpid != pid){
+    printf(stdout, "child's getpid() was not its pid\n");
+    exit();
+  }
+  wait();
+  close(fds[0]);
+  close(fds[1]);
+  printf(stdout, "info page test ok\n");
+}
+
 // does unintialized data start out zero?
 char uninit[10000];
 void
@@ -1492,6 +1704,10 @@ main(int argc, char *argv[])
 
   bigargtest();
   bsstest();
+  clocktest();
+  infotest();
+  cowtest();
+  lazytest();
   sbrktest();
   validatetest();
 
@@ -1499,6 +1715,7 @@ main(int argc, char *argv[])
   writetest();
   writetest1();
   createtest();
+  synctest();
 
   mem();
   pipe1();